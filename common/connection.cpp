@@ -16,13 +16,18 @@
  */
 
 #include "connection.h"
+#include "hostcache.h"
+#include "credentialstore.h"
 
 #include <libqinfinity/ipaddress.h>
 #include <libqinfinity/tcpconnection.h>
 #include <libqinfinity/xmppconnection.h>
 
+#include <gsasl.h>
+
 #include <QHostInfo>
 #include <QHostAddress>
+#include <QTcpSocket>
 #include <QDebug>
 #include <QApplication>
 
@@ -31,6 +36,34 @@
 namespace Kobby
 {
 
+// Delay before the first reconnect attempt, in ms; doubled for each further attempt
+static const int initialReconnectDelay = 1000;
+static const int maximumReconnectDelay = 30000;
+// Delay between starting connection attempts to the different addresses of a host, in ms
+static const int probeDelay = 250;
+
+struct SaslCredentials {
+    Gsasl* context;
+    QByteArray userName;
+    QByteArray password;
+};
+
+// Provides the credentials to the SASL mechanism when it asks for them.
+static int saslCallback( Gsasl* context, Gsasl_session* session, Gsasl_property property )
+{
+    const SaslCredentials* credentials = static_cast<const SaslCredentials*>( gsasl_callback_hook_get( context ) );
+    switch ( property ) {
+        case GSASL_AUTHID:
+            gsasl_property_set( session, property, credentials->userName.constData() );
+            return GSASL_OK;
+        case GSASL_PASSWORD:
+            gsasl_property_set( session, property, credentials->password.constData() );
+            return GSASL_OK;
+        default:
+            return GSASL_NO_CALLBACK;
+    }
+}
+
 Connection::Connection( const QString &hostname,
     unsigned int port,
     const QString& name_,
@@ -41,11 +74,29 @@ Connection::Connection( const QString &hostname,
     , m_connectionStatus(QInfinity::XmlConnection::Closed)
     , m_tcpConnection( 0 )
     , m_xmppConnection( 0 )
+    , m_autoReconnect( false )
+    , m_reconnectAttempts( 0 )
+    , m_wasOpen( false )
+    , m_sasl( 0 )
 {
+    m_reconnectTimer.setSingleShot( true );
+    connect( &m_reconnectTimer, SIGNAL(timeout()),
+        this, SLOT(slotReconnect()) );
+    m_probeTimer.setSingleShot( true );
+    connect( &m_probeTimer, SIGNAL(timeout()),
+        this, SLOT(slotStartNextProbe()) );
 }
 
 Connection::~Connection()
 {
+    abortProbes();
+    if ( m_sasl ) {
+        // the xmpp connection uses the context until it is destroyed
+        delete m_xmppConnection;
+        m_xmppConnection = 0;
+        gsasl_done( m_sasl->context );
+        delete m_sasl;
+    }
 }
 
 void Connection::prepare()
@@ -59,7 +110,7 @@ void Connection::prepare()
         emit ready( this );
     }
     else {
-        QHostInfo::lookupHost( m_host.hostname, this,
+        HostCache::instance()->lookupHost( m_host.hostname, this,
             SLOT(slotHostnameLookedUp(const QHostInfo&)) );
     }
 }
@@ -92,17 +143,128 @@ void Connection::slotHostnameLookedUp( const QHostInfo &hostInfo )
         emit(error( this, "Host not found." ));
         return;
     }
+    if ( addresses.size() == 1 ) {
+        setupConnection( addresses.first() );
+        return;
+    }
+
+    // Alternate between the address families, beginning with the one the resolver
+    // prefers, so a broken IPv6 (or IPv4) setup only costs one probe delay.
+    QList<QHostAddress> preferred;
+    QList<QHostAddress> other;
+    const QAbstractSocket::NetworkLayerProtocol preferredFamily = addresses.first().protocol();
+    foreach ( const QHostAddress& address, addresses ) {
+        ( address.protocol() == preferredFamily ? preferred : other ) << address;
+    }
+    m_untriedAddresses.clear();
+    while ( ! preferred.isEmpty() || ! other.isEmpty() ) {
+        if ( ! preferred.isEmpty() ) {
+            m_untriedAddresses << preferred.takeFirst();
+        }
+        if ( ! other.isEmpty() ) {
+            m_untriedAddresses << other.takeFirst();
+        }
+    }
+    m_fallbackAddress = addresses.first();
+    qDebug() << "host" << m_host.hostname << "has" << addresses.size() << "addresses, trying all of them";
+    slotStartNextProbe();
+}
+
+void Connection::slotStartNextProbe()
+{
+    if ( m_untriedAddresses.isEmpty() ) {
+        return;
+    }
+    const QHostAddress address = m_untriedAddresses.takeFirst();
+    qDebug() << "trying address" << address.toString();
+    QTcpSocket* probe = new QTcpSocket( this );
+    probe->setProperty( "address", address.toString() );
+    connect( probe, SIGNAL(connected()),
+        this, SLOT(slotProbeConnected()) );
+    connect( probe, SIGNAL(error(QAbstractSocket::SocketError)),
+        this, SLOT(slotProbeFailed()) );
+    m_probes << probe;
+    probe->connectToHost( address, m_host.port );
+    if ( ! m_untriedAddresses.isEmpty() ) {
+        m_probeTimer.start( probeDelay );
+    }
+}
+
+void Connection::slotProbeConnected()
+{
+    QTcpSocket* probe = qobject_cast<QTcpSocket*>( sender() );
+    if ( ! probe || ! m_probes.contains( probe ) ) {
+        return;
+    }
+    const QHostAddress address = probe->peerAddress();
+    qDebug() << "address" << address.toString() << "answered first, using it";
+    abortProbes();
+    setupConnection( address );
+}
 
-    m_tcpConnection = new QInfinity::TcpConnection( QInfinity::IpAddress( addresses[0] ),
+void Connection::slotProbeFailed()
+{
+    QTcpSocket* probe = qobject_cast<QTcpSocket*>( sender() );
+    if ( ! probe || ! m_probes.removeOne( probe ) ) {
+        return;
+    }
+    qDebug() << "address" << probe->property( "address" ).toString() << "failed:" << probe->errorString();
+    probe->disconnect( this );
+    probe->deleteLater();
+    if ( ! m_untriedAddresses.isEmpty() ) {
+        // don't wait for the delay, this one is known to be useless
+        m_probeTimer.stop();
+        slotStartNextProbe();
+    }
+    else if ( m_probes.isEmpty() ) {
+        // Nothing works; let the real connection attempt report the error.
+        setupConnection( m_fallbackAddress );
+    }
+}
+
+void Connection::abortProbes()
+{
+    m_probeTimer.stop();
+    m_untriedAddresses.clear();
+    foreach ( QTcpSocket* probe, m_probes ) {
+        probe->disconnect( this );
+        probe->abort();
+        probe->deleteLater();
+    }
+    m_probes.clear();
+}
+
+void Connection::setupConnection( const QHostAddress& address )
+{
+    m_tcpConnection = new QInfinity::TcpConnection( QInfinity::IpAddress( address ),
         m_host.port,
         this );
 
+    // If a password is known for the server, authenticate with it right away;
+    // otherwise, libinfinity uses anonymous authentication.
+    QString userName;
+    QString password;
+    if ( CredentialStore::instance()->find( m_host, &userName, &password ) ) {
+        Gsasl* context = 0;
+        if ( gsasl_init( &context ) == GSASL_OK ) {
+            m_sasl = new SaslCredentials;
+            m_sasl->context = context;
+            m_sasl->userName = userName.toUtf8();
+            m_sasl->password = password.toUtf8();
+            gsasl_callback_hook_set( context, m_sasl );
+            gsasl_callback_set( context, saslCallback );
+        }
+    }
+
     m_xmppConnection = new QInfinity::XmppConnection( *m_tcpConnection,
         QInfinity::XmppConnection::Client,
         "localhost",
         m_host.hostname,
-        QInfinity::XmppConnection::PreferTls,
-        0, 0, 0,
+        // PLAIN sends the password as it is, so never do that without encryption
+        m_sasl ? QInfinity::XmppConnection::OnlyTls : QInfinity::XmppConnection::PreferTls,
+        0,
+        m_sasl ? m_sasl->context : 0,
+        m_sasl ? "PLAIN" : 0,
         this );
 
     connect( m_xmppConnection, SIGNAL(statusChanged()),
@@ -123,6 +285,33 @@ Host Connection::host() const
     return m_host;
 }
 
+void Connection::setAutoReconnect( bool autoReconnect )
+{
+    m_autoReconnect = autoReconnect;
+    if ( ! autoReconnect ) {
+        m_reconnectTimer.stop();
+    }
+}
+
+bool Connection::autoReconnect() const
+{
+    return m_autoReconnect;
+}
+
+bool Connection::willReconnect() const
+{
+    return m_autoReconnect && m_wasOpen;
+}
+
+void Connection::slotReconnect()
+{
+    if ( ! m_tcpConnection || m_connectionStatus != QInfinity::XmlConnection::Closed ) {
+        return;
+    }
+    qDebug() << "trying to reconnect to" << m_host.hostname << m_host.port;
+    m_tcpConnection->open();
+}
+
 void Connection::slotStatusChanged()
 {
     m_connectionStatus = m_xmppConnection->status();
@@ -136,9 +325,17 @@ void Connection::slotStatusChanged()
             emit(disconnecting( this ));
             break;
         case QInfinity::XmlConnection::Open:
+            m_wasOpen = true;
+            m_reconnectAttempts = 0;
             emit(connected( this ));
             break;
         case QInfinity::XmlConnection::Closed:
+            if ( m_autoReconnect && m_wasOpen ) {
+                const int delay = qMin( initialReconnectDelay << qMin( m_reconnectAttempts, 5 ),
+                                        maximumReconnectDelay );
+                m_reconnectAttempts += 1;
+                m_reconnectTimer.start( delay );
+            }
             emit(disconnected( this ));
     }
 }
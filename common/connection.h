@@ -21,11 +21,14 @@
 #include <libqinfinity/xmlconnection.h>
 
 #include <QObject>
+#include <QTimer>
+#include <QHostAddress>
 #include <QDebug>
 
 #include <glib.h>
 
 class QHostInfo;
+class QTcpSocket;
 
 namespace QInfinity
 {
@@ -46,6 +49,8 @@ struct Host {
     int port;
 };
 
+struct SaslCredentials;
+
 /**
  * @brief Ties connection/creation monitoring to simple interface.
  */
@@ -75,6 +80,15 @@ class KTECOLLABORATIVECOMMON_EXPORT Connection
         QInfinity::XmlConnection::Status status() const;
         // Returns the host this connection is for.
         Host host() const;
+        // If enabled, a connection which was open and gets closed is re-opened
+        // automatically, with increasing delays between the attempts.
+        // disconnected() is still emitted when the connection is lost.
+        void setAutoReconnect( bool autoReconnect );
+        bool autoReconnect() const;
+        // True if the connection will be re-opened after it was closed, i.e. auto reconnect
+        // is enabled and the connection was open before. A connection which never
+        // opened (e.g. wrong port) is not retried.
+        bool willReconnect() const;
 
     Q_SIGNALS:
         void connecting( Connection *conn );
@@ -93,14 +107,43 @@ class KTECOLLABORATIVECOMMON_EXPORT Connection
         void slotHostnameLookedUp( const QHostInfo &hostInfo );
         void slotStatusChanged();
         void slotError( const GError *err );
+        void slotReconnect();
+        void slotStartNextProbe();
+        void slotProbeConnected();
+        void slotProbeFailed();
 
     private:
+        // Sets up the tcp and xmpp connections for the given address, and emits ready().
+        void setupConnection( const QHostAddress& address );
+        // Stops and deletes all pending probes.
+        void abortProbes();
+
         Host m_host;
         // A unique identifier for a particular host/port combination, usually host:port.
         const QString m_name;
         QInfinity::XmlConnection::Status m_connectionStatus;
         QInfinity::TcpConnection *m_tcpConnection;
         QInfinity::XmppConnection *m_xmppConnection;
+        bool m_autoReconnect;
+        // Number of reconnect attempts since the connection was last open
+        int m_reconnectAttempts;
+        bool m_wasOpen;
+        QTimer m_reconnectTimer;
+
+        // If the host name resolves to multiple addresses, all of them are tried
+        // ("happy eyeballs"): a plain TCP connection attempt is started for each address
+        // in turn, a short delay after the previous one, without waiting for the previous
+        // one to fail. The first address which accepts the connection is used.
+        // Addresses for which no probe was started yet, in the order they will be tried
+        QList<QHostAddress> m_untriedAddresses;
+        // The first address the host name resolved to, used if no probe succeeds
+        QHostAddress m_fallbackAddress;
+        QList<QTcpSocket*> m_probes;
+        QTimer m_probeTimer;
+
+        // SASL context used for authenticating with the credentials from the
+        // CredentialStore; null if there are none for this host.
+        SaslCredentials* m_sasl;
 
 };
 
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2013  Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "credentialstore.h"
+
+#include <KUrl>
+
+namespace Kobby
+{
+
+static QString keyForHost( const Host& host )
+{
+    return host.hostname.toLower() + ':' + QString::number( host.port );
+}
+
+CredentialStore::CredentialStore()
+{
+}
+
+CredentialStore* CredentialStore::instance()
+{
+    static CredentialStore* m_self = new CredentialStore();
+    return m_self;
+}
+
+void CredentialStore::insert( const Host& host, const QString& userName, const QString& password )
+{
+    if ( password.isEmpty() ) {
+        remove( host );
+        return;
+    }
+    Credentials credentials;
+    credentials.userName = userName;
+    credentials.password = password;
+    m_credentials.insert( keyForHost( host ), credentials );
+}
+
+void CredentialStore::insert( const KUrl& url )
+{
+    if ( ! url.hasPass() ) {
+        return;
+    }
+    insert( Host( url.host(), url.port() ), url.user(), url.pass() );
+}
+
+bool CredentialStore::find( const Host& host, QString* userName, QString* password ) const
+{
+    QHash<QString, Credentials>::const_iterator it = m_credentials.constFind( keyForHost( host ) );
+    if ( it == m_credentials.constEnd() ) {
+        return false;
+    }
+    *userName = it->userName;
+    *password = it->password;
+    return true;
+}
+
+void CredentialStore::remove( const Host& host )
+{
+    m_credentials.remove( keyForHost( host ) );
+}
+
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2013  Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KOBBY_CREDENTIALSTORE_H
+#define KOBBY_CREDENTIALSTORE_H
+
+#include "ktecollaborative_export.h"
+#include "connection.h"
+
+#include <QHash>
+#include <QString>
+
+class KUrl;
+
+namespace Kobby
+{
+
+/**
+ * @brief Remembers user names and passwords for servers, in memory, for this process.
+ *
+ * Once a password was given for a server (e.g. in a URL), all further
+ * connections to it use the same credentials for authenticating, without
+ * asking again. Nothing is written to disk.
+ */
+class KTECOLLABORATIVECOMMON_EXPORT CredentialStore
+{
+    public:
+        static CredentialStore* instance();
+
+        // Remembers the credentials for @p host; an empty password removes them.
+        void insert( const Host& host, const QString& userName, const QString& password );
+        // Remembers the credentials contained in @p url, if it contains a password.
+        void insert( const KUrl& url );
+        // Returns false if no credentials are known for @p host.
+        bool find( const Host& host, QString* userName, QString* password ) const;
+        void remove( const Host& host );
+
+    private:
+        CredentialStore();
+
+        struct Credentials {
+            QString userName;
+            QString password;
+        };
+        // Known credentials, by "hostname:port"
+        QHash<QString, Credentials> m_credentials;
+};
+
+}
+
+#endif
@@ -134,6 +134,9 @@ void Document::throwFatalError( const QString &message )
     emit( fatalError( this, message ) );
 }
 
+// Typing after a pause longer than this (in ms) begins a new undo step
+static const int undoGroupPause = 1000;
+
 KDocumentTextBuffer::KDocumentTextBuffer( KTextEditor::Document* kDocument,
     const QString &encoding,
     Kobby::NotePlugin* plugin,
@@ -144,7 +147,18 @@ KDocumentTextBuffer::KDocumentTextBuffer( KTextEditor::Document* kDocument,
     , m_kDocument( kDocument )
     , m_session(0)
     , m_undoGrouping( QInfinity::UndoGrouping::wrap(inf_text_undo_grouping_new(), this) )
+    , m_lastEditKind( NoEdit )
+    , m_lastEditOffset( 0 )
+    , m_lastEditEnd( 0 )
+    , m_lastEditEndedWithSpace( false )
+    , m_lastEditIsStep( false )
+    , m_canUndo( false )
+    , m_canRedo( false )
+    , m_inBatch( false )
+    , m_batchRemovalOffset( -1 )
     , m_aboutToClose( false )
+    , m_remoteCharacters( 0 )
+    , m_remoteOperations( 0 )
 {
     plugin->registerTextBuffer(kDocument->url().path(), this);
     kDebug() << "new text buffer for document" << kDocument;
@@ -152,10 +166,6 @@ KDocumentTextBuffer::KDocumentTextBuffer( KTextEditor::Document* kDocument,
         this, SLOT(localTextInserted(KTextEditor::Document*, const KTextEditor::Range&)) );
     connect( kDocument, SIGNAL(textRemoved(KTextEditor::Document*, const KTextEditor::Range&, const QString&)),
         this, SLOT(localTextRemoved(KTextEditor::Document*, const KTextEditor::Range&, const QString&)) );
-    m_undoTimer.setInterval(300);
-    m_undoTimer.setSingleShot(true);
-    connect( &m_undoTimer, SIGNAL(timeout()),
-        this, SLOT(nextUndoStep()) );
 }
 
 void KDocumentTextBuffer::nextUndoStep()
@@ -173,10 +183,24 @@ KDocumentTextBuffer::~KDocumentTextBuffer()
 
 void KDocumentTextBuffer::resetUndoRedo()
 {
+    m_canUndo = false;
+    m_canRedo = false;
     emit canUndo(false);
     emit canRedo(false);
 }
 
+void KDocumentTextBuffer::setUndoRedoState( bool undo, bool redo )
+{
+    if ( undo != m_canUndo ) {
+        m_canUndo = undo;
+        emit canUndo(undo);
+    }
+    if ( redo != m_canRedo ) {
+        m_canRedo = redo;
+        emit canRedo(redo);
+    }
+}
+
 KTextEditor::Document *KDocumentTextBuffer::kDocument() const
 {
     return m_kDocument;
@@ -212,6 +236,8 @@ void KDocumentTextBuffer::onInsertText( unsigned int offset,
     {
         kDebug() << "REMOTE INSERT TEXT offset" << offset << kDocument()
                  << "(" << chunk.length() << " chars )" << kDocument()->url();
+        m_remoteCharacters += chunk.length();
+        m_remoteOperations += 1;
         KTextEditor::Cursor startCursor = offsetToCursor_kte( offset );
         QString str = codec()->toUnicode( chunk.text() );
         ReadWriteTransaction transaction(kDocument());
@@ -219,7 +245,17 @@ void KDocumentTextBuffer::onInsertText( unsigned int offset,
         kDocument()->insertText( startCursor, str );
         kDocument()->blockSignals(false);
         Q_ASSERT(!qobject_cast<KTextEditor::ConfigInterface*>(kDocument())->configValue("replace-tabs").toBool());
-        emit remoteChangedText(KTextEditor::Range(startCursor, offsetToCursor_kte(offset+chunk.length())), user, false);
+        const int newlines = str.count('\n');
+        const KTextEditor::Cursor endCursor = newlines == 0
+            ? KTextEditor::Cursor(startCursor.line(), startCursor.column() + str.length())
+            : KTextEditor::Cursor(startCursor.line() + newlines, str.length() - str.lastIndexOf('\n') - 1);
+        const KTextEditor::Range range(startCursor, endCursor);
+        emit textEdited(range, user, false);
+        if ( m_inBatch ) {
+            addToBatch(offset, chunk.length(), user, false);
+            return;
+        }
+        emit remoteChangedText(range, user, false);
         checkConsistency();
     }
     else
@@ -241,6 +277,7 @@ void KDocumentTextBuffer::onEraseText( unsigned int offset,
     if( !blockRemoteRemove )
     {
         kDebug() << "REMOTE ERASE TEXT len" << length << "offset" << offset << kDocument()->url();
+        m_remoteOperations += 1;
         KTextEditor::Cursor startCursor = offsetRelativeTo_kte(KTextEditor::Cursor(0, 0), offset);
         KTextEditor::Cursor endCursor = offsetRelativeTo_kte(startCursor, length);
         KTextEditor::Range range = KTextEditor::Range(startCursor, endCursor);
@@ -258,6 +295,11 @@ void KDocumentTextBuffer::onEraseText( unsigned int offset,
             kDocument()->removeText( range );
             kDocument()->blockSignals(false);
         }
+        emit textEdited(range, user, true);
+        if ( m_inBatch ) {
+            addToBatch(offset, length, user, true);
+            return;
+        }
         emit remoteChangedText(range, user, true);
         checkConsistency();
     }
@@ -265,6 +307,102 @@ void KDocumentTextBuffer::onEraseText( unsigned int offset,
         blockRemoteRemove = false;
 }
 
+void KDocumentTextBuffer::beginBatch()
+{
+    Q_ASSERT( ! m_inBatch );
+    m_inBatch = true;
+    m_batchUser = 0;
+    m_batchInsertions.clear();
+    m_batchRemovalOffset = -1;
+    kDocument()->startEditing();
+}
+
+// Where @p position ends up after @p length characters were removed at @p offset
+static unsigned int positionAfterRemoval( unsigned int position, unsigned int offset, unsigned int length )
+{
+    if ( position <= offset ) {
+        return position;
+    }
+    return position >= offset + length ? position - length : offset;
+}
+
+void KDocumentTextBuffer::addToBatch( unsigned int offset, unsigned int length, QInfinity::User* user, bool removal )
+{
+    m_batchUser = user;
+    QList< QPair<unsigned int, unsigned int> >::iterator it = m_batchInsertions.begin();
+    while ( it != m_batchInsertions.end() ) {
+        unsigned int start = it->first;
+        unsigned int end = it->first + it->second;
+        if ( removal ) {
+            start = positionAfterRemoval(start, offset, length);
+            end = positionAfterRemoval(end, offset, length);
+        }
+        else if ( offset <= start ) {
+            start += length;
+            end += length;
+        }
+        else if ( offset < end ) {
+            end += length;
+        }
+        if ( start == end ) {
+            it = m_batchInsertions.erase(it);
+            continue;
+        }
+        *it = qMakePair(start, end - start);
+        ++it;
+    }
+    if ( removal ) {
+        m_batchRemovalOffset = offset;
+        return;
+    }
+    if ( m_batchRemovalOffset > (int) offset ) {
+        m_batchRemovalOffset += length;
+    }
+    // Join adjacent insertions, so each piece of text is announced only once.
+    for ( it = m_batchInsertions.begin(); it != m_batchInsertions.end(); ++it ) {
+        const unsigned int end = it->first + it->second;
+        if ( offset >= it->first && offset + length <= end ) {
+            // inserted into this one, which was already made larger above
+            return;
+        }
+        if ( offset == end ) {
+            it->second += length;
+            return;
+        }
+        if ( offset + length == it->first ) {
+            *it = qMakePair(offset, it->second + length);
+            return;
+        }
+    }
+    m_batchInsertions << qMakePair(offset, length);
+}
+
+void KDocumentTextBuffer::endBatch()
+{
+    Q_ASSERT( m_inBatch );
+    m_inBatch = false;
+    kDocument()->endEditing();
+    if ( m_aboutToClose ) {
+        return;
+    }
+    kDebug() << "applied batch of operations," << m_batchInsertions.size() << "insertions";
+    if ( m_batchUser ) {
+        typedef QPair<unsigned int, unsigned int> Insertion;
+        foreach ( const Insertion& insertion, m_batchInsertions ) {
+            const KTextEditor::Range range(offsetToCursor_kte(insertion.first),
+                                           offsetToCursor_kte(insertion.first + insertion.second));
+            emit remoteChangedText(range, m_batchUser, false);
+        }
+        if ( m_batchInsertions.isEmpty() && m_batchRemovalOffset != -1 ) {
+            const KTextEditor::Cursor position = offsetToCursor_kte(m_batchRemovalOffset);
+            emit remoteChangedText(KTextEditor::Range(position, position), m_batchUser, true);
+        }
+    }
+    m_batchInsertions.clear();
+    m_batchUser = 0;
+    checkConsistency();
+}
+
 void KDocumentTextBuffer::checkConsistency()
 {
     QString bufferContents = codec()->toUnicode( slice(0, length())->text() );
@@ -303,23 +441,28 @@ void KDocumentTextBuffer::localTextInserted( KTextEditor::Document *document,
     emit localChangedText(range, user(), false);
     Q_UNUSED(document)
 
-    textOpPerformed();
     if( m_user.isNull() ) {
         kDebug() << "Could not insert text: No local user set.";
+        emit textEdited(range, user(), false);
         return;
     }
     unsigned int offset = cursorToOffset_kte(range.start());
     kDebug() << "local text inserted" << kDocument() << "( range" << range << ")" << m_user << "offset:" << offset;
     QInfinity::TextChunk chunk(encoding());
     QString text = kDocument()->text(range);
+    KTextEditor::Range insertedRange = range;
 #ifdef ENABLE_TAB_HACK
     if ( text.contains('\t') ) {
+        // Only the tabs on the last line move the end of the inserted text
+        const int lastLineTabs = text.mid(text.lastIndexOf('\n') + 1).count('\t');
         text = text.replace('\t', "    ");
         kDocument()->blockSignals(true);
         kDocument()->replaceText(range, text);
         kDocument()->blockSignals(false);
+        insertedRange.setEnd(KTextEditor::Cursor(range.end().line(), range.end().column() + 3 * lastLineTabs));
     }
 #endif
+    emit textEdited(insertedRange, user(), false);
     Q_ASSERT(encoder());
     if ( text.isEmpty() ) {
         kDebug() << "Skipping empty insert.";
@@ -331,6 +474,7 @@ void KDocumentTextBuffer::localTextInserted( KTextEditor::Document *document,
                     "Skipping insertion";
     }
     else {
+        textOpPerformed( InsertEdit, offset, text );
         chunk.insertText( 0, encodedText, countUnicodeCharacters(text), m_user->id() );
         blockRemoteInsert = true;
         kDebug() << "inserting chunk of size" << chunk.length() << "into local buffer" << kDocument()->url();
@@ -347,10 +491,10 @@ void KDocumentTextBuffer::localTextRemoved( KTextEditor::Document *document,
 
     kDebug() << "local text removed:" << kDocument() << range;
     emit localChangedText(range, user(), true);
+    emit textEdited(range, user(), true);
 
     Q_UNUSED(document)
 
-    textOpPerformed();
     if( !m_user.isNull() )
     {
         unsigned int offset = cursorToOffset_kte( range.start() );
@@ -358,8 +502,10 @@ void KDocumentTextBuffer::localTextRemoved( KTextEditor::Document *document,
         blockRemoteRemove = true;
         kDebug() << "ERASING TEXT" << oldText << "with len" << len << "offset" << offset << "range" << range;
         kDebug() << offset << len << length();
-        if( len > 0 )
+        if( len > 0 ) {
+            textOpPerformed( RemoveEdit, offset, oldText );
             eraseText( offset, len, m_user );
+        }
         else
             kDebug() << "0 legth delete operation. Skipping.";
         checkConsistency();
@@ -377,12 +523,14 @@ void KDocumentTextBuffer::setUser( QPointer<QInfinity::User> user )
 
 void KDocumentTextBuffer::updateUndoRedoActions()
 {
-    emit canUndo(dynamic_cast<QInfinity::AdoptedSession*>(m_session)->canUndo(
-        *dynamic_cast<QInfinity::AdoptedUser*>(m_user.data()))
-    );
-    emit canRedo(dynamic_cast<QInfinity::AdoptedSession*>(m_session)->canRedo(
-        *dynamic_cast<QInfinity::AdoptedUser*>(m_user.data()))
-    );
+    // Called after undo or redo; whatever is typed next is a new step.
+    m_lastEditKind = NoEdit;
+    QInfinity::AdoptedSession* session = dynamic_cast<QInfinity::AdoptedSession*>(m_session);
+    QInfinity::AdoptedUser* user = dynamic_cast<QInfinity::AdoptedUser*>(m_user.data());
+    if ( ! session || ! user ) {
+        return;
+    }
+    setUndoRedoState(session->canUndo(*user), session->canRedo(*user));
 }
 
 void KDocumentTextBuffer::setSession(QInfinity::Session* session)
@@ -463,17 +611,42 @@ unsigned int KDocumentTextBuffer::cursorToOffset_kte( const KTextEditor::Cursor
     return offset;
 }
 
-void KDocumentTextBuffer::textOpPerformed()
+bool KDocumentTextBuffer::beginsUndoStep( EditKind kind, unsigned int offset, const QString& text ) const
+{
+    if ( ! m_undoGrouping->hasOpenGroup() || kind != m_lastEditKind || m_lastEditIsStep ) {
+        return true;
+    }
+    if ( m_lastEditTime.elapsed() > undoGroupPause ) {
+        return true;
+    }
+    if ( kind == InsertEdit ) {
+        // Typing continues where the previous character was inserted;
+        // a new word begins when a space follows something else.
+        return offset != m_lastEditEnd || ( text.at(0).isSpace() && ! m_lastEditEndedWithSpace );
+    }
+    // Backspace removes the character in front of the previous one, delete the one at the same position.
+    return offset + countUnicodeCharacters(text) != m_lastEditOffset && offset != m_lastEditOffset;
+}
+
+void KDocumentTextBuffer::textOpPerformed( EditKind kind, unsigned int offset, const QString& text )
 {
     if ( ! m_user ) {
         // cannot undo synchronization operations
         return;
     }
-    else {
-        kDebug() << "starting undo timer";
-        m_undoTimer.start();
-        updateUndoRedoActions();
+    if ( beginsUndoStep(kind, offset, text) ) {
+        nextUndoStep();
     }
+    const int characters = countUnicodeCharacters(text);
+    m_lastEditKind = kind;
+    m_lastEditOffset = offset;
+    m_lastEditEnd = kind == InsertEdit ? offset + characters : offset;
+    m_lastEditEndedWithSpace = text.at(text.length() - 1).isSpace();
+    m_lastEditIsStep = characters > 1 || text.contains('\n');
+    m_lastEditTime.start();
+    // Doing something always makes it possible to undo it, and impossible to redo what was undone before;
+    // no need to ask the session about that.
+    setUndoRedoState(true, false);
 }
 
 void KDocumentTextBuffer::checkLineEndings()
@@ -573,6 +746,11 @@ QPointer<QInfinity::TextSession> InfTextDocument::infSession() const
     return m_session;
 }
 
+void InfTextDocument::setPreferredUserName( const QString& userName )
+{
+    m_preferredUserName = userName;
+}
+
 void InfTextDocument::leave()
 {
     if( m_user )
@@ -583,7 +761,9 @@ void InfTextDocument::undo()
 {
     kDebug() << "UNDO" << m_user;
     if( m_user ) {
+        m_buffer->beginBatch();
         m_session->undo( *m_user, m_buffer->m_undoGrouping->undoSize() );
+        m_buffer->endBatch();
     }
     m_buffer->updateUndoRedoActions();
 }
@@ -592,7 +772,9 @@ void InfTextDocument::redo()
 {
     kDebug() << "REDO";
     if( m_user ) {
+        m_buffer->beginBatch();
         m_session->redo( *m_user, m_buffer->m_undoGrouping->redoSize() );
+        m_buffer->endBatch();
     }
     m_buffer->updateUndoRedoActions();
 }
@@ -753,6 +935,9 @@ void InfTextDocument::joinSession(const QString& forceUserName)
         if ( ! forceUserName.isEmpty() ) {
             userName = forceUserName;
         }
+        else if ( ! m_preferredUserName.isEmpty() ) {
+            userName = m_preferredUserName;
+        }
         else if ( ! kDocument()->url().userName().isEmpty() ) {
             userName = kDocument()->url().userName();
         }
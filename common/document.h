@@ -24,7 +24,9 @@
 #include <QObject>
 #include <QPointer>
 #include <QStack>
+#include <QPair>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <KUrl>
 #include <KTextEditor/Document>
 
@@ -170,6 +172,11 @@ class KTECOLLABORATIVECOMMON_EXPORT Document
  * The KDocumentTextBuffer ties together remote and local insertion
  * and removal operations.  It is also responsible for maintaining
  * undo/redo stats (insertionCount and undoCount).
+ *
+ * Local operations are grouped into undo steps like in a normal editor:
+ * a step ends at word and line boundaries, when typing pauses, when the cursor
+ * is moved, or when switching between typing and deleting. Pasted text and
+ * removed selections are steps of their own.
  */
 class KTECOLLABORATIVECOMMON_EXPORT KDocumentTextBuffer
     : public QInfinity::AbstractTextBuffer
@@ -197,10 +204,18 @@ class KTECOLLABORATIVECOMMON_EXPORT KDocumentTextBuffer
 
         void updateUndoRedoActions();
 
+        // All offsets are in unicode code points, all cursors are in utf-16 surrogates.
+        KTextEditor::Cursor offsetToCursor_kte( unsigned int offset );
+        unsigned int cursorToOffset_kte( const KTextEditor::Cursor &cursor );
+
         void checkConsistency();
         void checkLineEndings();
         void shutdown();
 
+        // Number of characters / operations received from other users (including the synchronization)
+        unsigned int remoteCharacterCount() const { return m_remoteCharacters; }
+        unsigned int remoteOperationCount() const { return m_remoteOperations; }
+
     Q_SIGNALS:
         void canUndo( bool enable );
         void canRedo( bool enable );
@@ -209,6 +224,9 @@ class KTECOLLABORATIVECOMMON_EXPORT KDocumentTextBuffer
         void remoteChangedText( const KTextEditor::Range& range, QInfinity::User* user, bool removal );
         // Emitted when you changed text
         void localChangedText( const KTextEditor::Range& range, QInfinity::User* user, bool removal );
+        // Emitted for every change to the text, local or remote, right after it was applied.
+        // Unlike remoteChangedText(), this is also emitted for each operation of an undo or redo.
+        void textEdited( const KTextEditor::Range& range, QInfinity::User* user, bool removal );
 
     public Q_SLOTS:
         void nextUndoStep();
@@ -221,13 +239,31 @@ class KTECOLLABORATIVECOMMON_EXPORT KDocumentTextBuffer
         void replaceLineEndings();
 
     private:
-        // All offsets are in unicode code points, all cursors are in utf-16 surrogates.
         KTextEditor::Cursor offsetRelativeTo_kte(const KTextEditor::Cursor& cursor,
                                                  const unsigned int offset);
-        KTextEditor::Cursor offsetToCursor_kte( unsigned int offset );
-        unsigned int cursorToOffset_kte( const KTextEditor::Cursor &cursor );
-        void textOpPerformed();
+        enum EditKind {
+            NoEdit,
+            InsertEdit,
+            RemoveEdit
+        };
+        /**
+         * @brief Must be called for each local operation, before it is passed on to the session.
+         * Decides whether the operation begins a new undo step, and updates the undo/redo state.
+         * @param offset position of the operation, in unicode code points
+         * @param text the inserted or removed text
+         */
+        void textOpPerformed( EditKind kind, unsigned int offset, const QString& text );
+        bool beginsUndoStep( EditKind kind, unsigned int offset, const QString& text ) const;
         void resetUndoRedo();
+        void setUndoRedoState( bool canUndo, bool canRedo );
+        /**
+         * @brief Applies all following remote operations to the document as one edit, until endBatch().
+         * Used for undo and redo, which may consist of many operations; the consistency check
+         * and the remoteChangedText() signals are done once in endBatch(), for the final text.
+         */
+        void beginBatch();
+        void endBatch();
+        void addToBatch( unsigned int offset, unsigned int length, QInfinity::User* user, bool removal );
 
         bool blockRemoteInsert;
         bool blockRemoteRemove;
@@ -236,10 +272,30 @@ class KTECOLLABORATIVECOMMON_EXPORT KDocumentTextBuffer
 
         // Undo/Redo management
         QInfinity::Session* m_session;
-        QTimer m_undoTimer;
         QPointer<QInfinity::UndoGrouping> m_undoGrouping;
+        // The previous local operation, for deciding where undo steps end
+        EditKind m_lastEditKind;
+        unsigned int m_lastEditOffset;
+        unsigned int m_lastEditEnd;
+        bool m_lastEditEndedWithSpace;
+        // The previous operation must not be grouped with anything following it
+        bool m_lastEditIsStep;
+        QElapsedTimer m_lastEditTime;
+        // Last state reported by canUndo() / canRedo()
+        bool m_canUndo;
+        bool m_canRedo;
+
+        // Remote operations applied since beginBatch()
+        bool m_inBatch;
+        QPointer<QInfinity::User> m_batchUser;
+        // Inserted text, as (offset, length), kept up to date with the following operations
+        QList< QPair<unsigned int, unsigned int> > m_batchInsertions;
+        // Position of the last removal, or -1 if nothing was removed
+        int m_batchRemovalOffset;
 
         bool m_aboutToClose;
+        unsigned int m_remoteCharacters;
+        unsigned int m_remoteOperations;
 
         friend class InfTextDocument;
 };
@@ -289,6 +345,11 @@ class KTECOLLABORATIVECOMMON_EXPORT InfTextDocument
         int type() const;
         QPointer<QInfinity::TextSession> infSession() const;
         void leave();
+        /**
+         * @brief Set the user name to join with, unless one is forced by the join dialog.
+         * Used to rejoin with the same name after the connection was re-established.
+         */
+        void setPreferredUserName( const QString& userName );
         
     public Q_SLOTS:
         void undo();
@@ -316,6 +377,7 @@ class KTECOLLABORATIVECOMMON_EXPORT InfTextDocument
         KDocumentTextBuffer *m_buffer;
         QPointer<QInfinity::AdoptedUser> m_user;
         QString m_name;
+        QString m_preferredUserName;
 
         // Undo/Redo actions
         QList<QAction*> undoActions;
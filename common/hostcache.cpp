@@ -0,0 +1,113 @@
+/*
+ * Copyright 2013  Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hostcache.h"
+
+#include <QHostAddress>
+#include <QDateTime>
+#include <QTimer>
+#include <QDebug>
+
+namespace Kobby
+{
+
+// How long results are cached, in ms. QHostInfo does not tell the record's TTL,
+// so these are fixed; a change of the address of a host is noticed after five minutes.
+static const qint64 positiveTimeToLive = 5 * 60 * 1000;
+static const qint64 negativeTimeToLive = 10 * 1000;
+
+HostLookup::HostLookup( QObject* parent )
+    : QObject( parent )
+{
+}
+
+void HostLookup::deliver()
+{
+    emit resultsReady( info );
+    deleteLater();
+}
+
+HostCache::HostCache()
+    : QObject()
+{
+}
+
+HostCache* HostCache::instance()
+{
+    static HostCache* m_self = new HostCache();
+    return m_self;
+}
+
+void HostCache::lookupHost( const QString& hostname, QObject* receiver, const char* member )
+{
+    HostLookup* lookup = new HostLookup( this );
+    connect( lookup, SIGNAL(resultsReady(QHostInfo)), receiver, member );
+
+    QHostAddress address;
+    if ( address.setAddress( hostname ) ) {
+        lookup->info.setHostName( hostname );
+        lookup->info.setAddresses( QList<QHostAddress>() << address );
+        QTimer::singleShot( 0, lookup, SLOT(deliver()) );
+        return;
+    }
+
+    const QString key = hostname.toLower();
+    QHash<QString, Entry>::iterator it = m_entries.find( key );
+    if ( it != m_entries.end() ) {
+        if ( it->expires > QDateTime::currentMSecsSinceEpoch() ) {
+            qDebug() << "using cached lookup result for" << hostname;
+            lookup->info = it->info;
+            QTimer::singleShot( 0, lookup, SLOT(deliver()) );
+            return;
+        }
+        m_entries.erase( it );
+    }
+
+    const bool running = m_waiting.contains( key );
+    m_waiting[key] << lookup;
+    if ( ! running ) {
+        const int id = QHostInfo::lookupHost( hostname, this, SLOT(slotHostLookedUp(QHostInfo)) );
+        m_running.insert( id, key );
+    }
+}
+
+void HostCache::clear()
+{
+    m_entries.clear();
+}
+
+void HostCache::slotHostLookedUp( const QHostInfo& info )
+{
+    const QString key = m_running.take( info.lookupId() );
+    if ( key.isEmpty() ) {
+        return;
+    }
+    const bool failed = info.error() != QHostInfo::NoError || info.addresses().isEmpty();
+    Entry entry;
+    entry.info = info;
+    entry.expires = QDateTime::currentMSecsSinceEpoch() + ( failed ? negativeTimeToLive : positiveTimeToLive );
+    m_entries.insert( key, entry );
+
+    foreach ( HostLookup* lookup, m_waiting.take( key ) ) {
+        lookup->info = info;
+        lookup->deliver();
+    }
+}
+
+}
+
+#include "hostcache.moc"
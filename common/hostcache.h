@@ -0,0 +1,93 @@
+/*
+ * Copyright 2013  Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KOBBY_HOSTCACHE_H
+#define KOBBY_HOSTCACHE_H
+
+#include "ktecollaborative_export.h"
+
+#include <QObject>
+#include <QHash>
+#include <QHostInfo>
+
+namespace Kobby
+{
+
+/**
+ * @brief Delivers the result of one lookup to its receiver; used by HostCache.
+ */
+class HostLookup : public QObject
+{
+    Q_OBJECT
+
+    public:
+        HostLookup( QObject* parent );
+        QHostInfo info;
+
+    public Q_SLOTS:
+        // Emits resultsReady() with info, and deletes itself.
+        void deliver();
+
+    Q_SIGNALS:
+        void resultsReady( const QHostInfo& info );
+};
+
+/**
+ * @brief Caches host name lookups for this process.
+ *
+ * Successful lookups are remembered for a few minutes, failed ones for a few
+ * seconds, so retrying a wrong host name does not hammer the resolver.
+ * Concurrent lookups for the same host name only ask the resolver once.
+ * Addresses (e.g. "127.0.0.1") are returned without asking the resolver at all.
+ */
+class KTECOLLABORATIVECOMMON_EXPORT HostCache
+    : public QObject
+{
+    Q_OBJECT
+
+    public:
+        static HostCache* instance();
+
+        // Works like QHostInfo::lookupHost(): the given slot of @p receiver
+        // is invoked with the QHostInfo for @p hostname later on, from the event loop.
+        // This also happens if the result is cached.
+        void lookupHost( const QString& hostname, QObject* receiver, const char* member );
+        // Forgets all cached results.
+        void clear();
+
+    private Q_SLOTS:
+        void slotHostLookedUp( const QHostInfo& info );
+
+    private:
+        HostCache();
+
+        struct Entry {
+            QHostInfo info;
+            // msecs since epoch after which the entry must not be used any more
+            qint64 expires;
+        };
+        // Cached results, by lower-case host name
+        QHash<QString, Entry> m_entries;
+        // Lookups waiting for the resolver, by lower-case host name
+        QHash<QString, QList<HostLookup*> > m_waiting;
+        // Host names being looked up, by lookup id
+        QHash<int, QString> m_running;
+};
+
+}
+
+#endif
@@ -28,7 +28,11 @@
 #include <klocale.h>
 
 #include <qcoreapplication.h>
+#include <QTime>
+#include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusMessage>
 #include <kdirnotify.h>
+#include <kio/authinfo.h>
 #include <libinftext/inf-text-session.h>
 #include <libinftext/inf-text-default-buffer.h>
 
@@ -46,6 +50,7 @@
 #include "common/itemfactory.h"
 #include "common/noteplugin.h"
 #include "common/utils.h"
+#include "common/credentialstore.h"
 
 using namespace KIO;
 using QInfinity::QGObject;
@@ -53,6 +58,13 @@ using QInfinity::QGSignal;
 using QInfinity::NodeRequest;
 using QInfinity::ExploreRequest;
 
+// Number of round trip times remembered for computing timeouts
+static const int latencySamples = 32;
+// Requests never time out faster than this, no matter how fast the server was before
+static const int minimumRequestTimeout = 2000;
+// Same for connecting, which involves looking up the host and possibly authentication
+static const int minimumConnectTimeout = 5000;
+
 extern "C" {
 
 int KDE_EXPORT kdemain( int argc, char **argv )
@@ -83,11 +95,49 @@ InfinityProtocol::InfinityProtocol(const QByteArray& pool_socket, const QByteArr
     : QObject()
     , SlaveBase("inf", pool_socket, app_socket)
     , m_notePlugin(0)
+    , m_connectionLost(false)
 {
     kDebug() << "constructing infinity kioslave";
     connect(this, SIGNAL(requestError(GError*)), this, SLOT(slotRequestError(GError*)));
 }
 
+LatencyTracker::LatencyTracker()
+    : m_next(0)
+{
+    m_samples.reserve(latencySamples);
+}
+
+void LatencyTracker::addSample(int msecs)
+{
+    if ( m_samples.size() < latencySamples ) {
+        m_samples.append(msecs);
+    }
+    else {
+        m_samples[m_next] = msecs;
+    }
+    m_next = (m_next + 1) % latencySamples;
+}
+
+void LatencyTracker::clear()
+{
+    m_samples.clear();
+    m_next = 0;
+}
+
+int LatencyTracker::timeout(int minimum, int maximum) const
+{
+    if ( m_samples.size() < 4 ) {
+        // Not enough data to guess anything
+        return maximum;
+    }
+    QVector<int> sorted(m_samples);
+    qSort(sorted);
+    const int percentile95 = sorted.at((sorted.size() * 95) / 100);
+    // Be generous: explore requests for big directories legitimately take
+    // longer than the typical request.
+    return qBound(minimum, percentile95 * 8, maximum);
+}
+
 void InfinityProtocol::get(const KUrl& url )
 {
     kDebug() << "GET " << url.url();
@@ -97,9 +147,12 @@ void InfinityProtocol::get(const KUrl& url )
 
     OrgKdeKDirNotifyInterface::emitEnteredDirectory(url.upUrl().url());
 
-    bool ok = false;
-    iterForUrl(url, &ok);
-    if ( ! ok ) {
+    QInfinity::BrowserIter iter(*browser());
+    bool exists = false;
+    if ( ! iterForUrl(url, &iter, &exists) ) {
+        return;
+    }
+    if ( ! exists ) {
         error(KIO::ERR_COULD_NOT_STAT, i18n("Could not get %1: The node does not exist.", url.url()));
         return;
     }
@@ -124,13 +177,37 @@ void InfinityProtocol::stat(const KUrl& url)
         return;
     }
 
+    QStringList siblings;
+    const QString name = url.fileName();
+    if ( ! name.isEmpty() && listThroughNotifier(url.upUrl(), &siblings) ) {
+        const bool isDirectory = siblings.contains(name + '/');
+        if ( isDirectory || siblings.contains(name) ) {
+            UDSEntry entry;
+            if ( ! isDirectory ) {
+                entry.insert(KIO::UDSEntry::UDS_MIME_TYPE, QString::fromLatin1("text/plain"));
+            }
+            entry.insert(KIO::UDSEntry::UDS_NAME, name);
+            entry.insert(KIO::UDSEntry::UDS_SIZE, 0);
+            entry.insert(KIO::UDSEntry::UDS_DISPLAY_NAME, name);
+            entry.insert(KIO::UDSEntry::UDS_FILE_TYPE, isDirectory ? S_IFDIR : S_IFREG);
+            entry.insert(KIO::UDSEntry::UDS_ACCESS, 07777);
+            statEntry(entry);
+            finished();
+            return;
+        }
+        // Not found; ask the server directly below, in case the notifier is not up to date.
+    }
+
     if ( ! doConnect(Peer(url)) ) {
         return;
     }
 
-    bool ok = false;
-    QInfinity::BrowserIter iter = iterForUrl(url, &ok);
-    if ( ! ok ) {
+    QInfinity::BrowserIter iter(*browser());
+    bool exists = false;
+    if ( ! iterForUrl(url, &iter, &exists) ) {
+        return;
+    }
+    if ( ! exists ) {
         error(KIO::ERR_COULD_NOT_STAT, i18n("Could not stat %1: No such file or directory.", url.url()));
         return;
     }
@@ -169,6 +246,8 @@ bool InfinityProtocol::doConnect(const Peer& peer)
         return true;
     }
 
+    resetConnection();
+    setupCredentials(peer);
     QEventLoop loop;
     m_connection = QSharedPointer<Kobby::Connection>(new Kobby::Connection(peer.hostname, peer.port, QString(), this));
     m_browserModel = QSharedPointer<QInfinity::BrowserModel>(new QInfinity::BrowserModel( this ));
@@ -180,36 +259,86 @@ bool InfinityProtocol::doConnect(const Peer& peer)
     m_notePlugin = new Kobby::NotePlugin(this);
     m_browserModel->addPlugin(*m_notePlugin);
 
+    // Give it a bit more time for connecting than usual, our connection method is complicated sometimes.
+    // That is only the upper bound though; if connecting to this host was fast before, give up earlier.
+    const QString hostKey = peer.hostname + ':' + QString::number(peer.port);
     QTimer timeout;
     timeout.setSingleShot(true);
-    // Give it a bit more time for connecting than usual, our connection method is complicated sometimes
-    timeout.setInterval(connectTimeout() * 1000 * 3);
+    timeout.setInterval(m_connectLatency.value(hostKey).timeout(minimumConnectTimeout, connectTimeout() * 1000 * 3));
     connect(&timeout, SIGNAL(timeout()), &loop, SLOT(quit()));
     timeout.start();
+    QTime elapsed;
+    elapsed.start();
     loop.exec();
     if ( ! timeout.isActive() || ! m_connection->xmppConnection() ) {
         kDebug() << "failed to look up hostname";
         error(KIO::ERR_UNKNOWN_HOST, peer.hostname);
         return false;
     }
-    m_connection->open();
     m_browserModel->addConnection(static_cast<QInfinity::XmlConnection*>(m_connection->xmppConnection()), "kio_root");
 
     connect(browser(), SIGNAL(connectionEstablished(const QInfinity::Browser*)),
             &loop, SLOT(quit()));
     connect(browser(), SIGNAL(error(const QInfinity::Browser*,QString)),
             &loop, SLOT(quit()));
+    // Don't wait for the timeout if the server refuses the connection
+    connect(m_connection.data(), SIGNAL(disconnected(Connection*)),
+            &loop, SLOT(quit()));
+    m_connection->open();
     loop.exec();
     if ( ! timeout.isActive() || browser()->connectionStatus() != INF_BROWSER_OPEN ) {
         kDebug() << "failed to connect";
         error(KIO::ERR_COULD_NOT_CONNECT, QString("%1:%2").arg(peer.hostname, QString::number(peer.port)));
+        resetConnection();
         return false;
     }
 
+    connect(m_connection.data(), SIGNAL(statusChanged(Connection*,QInfinity::XmlConnection::Status)),
+            this, SLOT(slotConnectionStatusChanged(Connection*,QInfinity::XmlConnection::Status)));
     m_connectedTo = peer;
+    m_connectLatency[hostKey].addSample(elapsed.elapsed());
     return true;
 }
 
+void InfinityProtocol::setupCredentials(const Peer& peer)
+{
+    KIO::AuthInfo info;
+    info.url.setProtocol("inf");
+    info.url.setHost(peer.hostname);
+    info.url.setPort(peer.port);
+    if ( ! peer.password.isEmpty() ) {
+        info.username = peer.userName;
+        info.password = peer.password;
+        cacheAuthentication(info);
+    }
+    else if ( ! checkCachedAuthentication(info) ) {
+        return;
+    }
+    Kobby::CredentialStore::instance()->insert(Kobby::Host(peer.hostname, peer.port), info.username, info.password);
+}
+
+void InfinityProtocol::resetConnection()
+{
+    if ( m_connection ) {
+        m_connection->disconnect(this);
+    }
+    m_connectedTo = Peer();
+    m_latency.clear();
+    // whatever happened to the old connection does not concern the next one
+    m_connectionLost = false;
+}
+
+void InfinityProtocol::slotConnectionStatusChanged(Connection* /*connection*/, QInfinity::XmlConnection::Status status)
+{
+    if ( status == QInfinity::XmlConnection::Closing || status == QInfinity::XmlConnection::Closed ) {
+        kDebug() << "connection to" << m_connectedTo.hostname << "lost";
+        m_connectionLost = true;
+        // Make sure the next request establishes a new connection
+        m_connectedTo = Peer();
+        emit connectionLost();
+    }
+}
+
 
 void InfinityProtocol::mimetype(const KUrl & url)
 {
@@ -246,7 +375,10 @@ void InfinityProtocol::put(const KUrl& url, int /*permissions*/, JobFlags /*flag
         error(KIO::ERR_INTERNAL, "Failed to read data");
         return;
     }
-    QInfinity::BrowserIter iter = iterForUrl(url.upUrl());
+    QInfinity::BrowserIter iter(*browser());
+    if ( ! iterForUrl(url.upUrl(), &iter) ) {
+        return;
+    }
     QInfinity::NodeRequest* req = 0;
     kDebug() << "adding note with content:" << size << "bytes";
     if ( size > 0 ) {
@@ -307,8 +439,11 @@ void InfinityProtocol::del(const KUrl& url, bool /*isfile*/)
         return;
     }
 
+    QInfinity::BrowserIter iter(*browser());
     bool itemExists = false;
-    QInfinity::BrowserIter iter = iterForUrl(url, &itemExists);
+    if ( ! iterForUrl(url, &iter, &itemExists) ) {
+        return;
+    }
     if ( ! itemExists ) {
         error(KIO::ERR_CANNOT_DELETE, i18n("Cannot delete %1: No such file or directory", url.url()));
         return;
@@ -330,7 +465,10 @@ void InfinityProtocol::mkdir(const KUrl& url, int /*permissions*/)
 
     OrgKdeKDirNotifyInterface::emitEnteredDirectory(url.url());
 
-    QInfinity::BrowserIter iter = iterForUrl(url.upUrl());
+    QInfinity::BrowserIter iter(*browser());
+    if ( ! iterForUrl(url.upUrl(), &iter) ) {
+        return;
+    }
     QInfinity::NodeRequest* req = browser()->addSubdirectory(iter, url.fileName().toAscii().data());
     connect(req, SIGNAL(finished(NodeRequest*)), this, SIGNAL(requestSuccessful(NodeRequest*)));
     connect(req, SIGNAL(failed(GError*)), this, SIGNAL(requestError(GError*)));
@@ -344,22 +482,40 @@ void InfinityProtocol::slotRequestError(GError* error)
     m_lastError = QString(error->message);
 }
 
-QInfinity::BrowserIter InfinityProtocol::iterForUrl(const KUrl& url, bool* ok)
+bool InfinityProtocol::iterForUrl(const KUrl& url, QInfinity::BrowserIter* iter, bool* exists)
 {
     KUrl clean(url);
     clean.cleanPath(KUrl::SimplifyDirSeparators);
-    IterLookupHelper helper(clean.path(KUrl::AddTrailingSlash), browser());
+    const QString path = clean.path(KUrl::AddTrailingSlash);
+    IterLookupHelper helper(path, browser());
     QEventLoop loop;
     connect(&helper, SIGNAL(done(QInfinity::BrowserIter)), &loop, SLOT(quit()));
     connect(&helper, SIGNAL(failed()), &loop, SLOT(quit()));
+    connect(this, SIGNAL(connectionLost()), &loop, SLOT(quit()));
+    // The lookup explores at most one directory per path component
+    QTimer timeout;
+    timeout.setSingleShot(true);
+    timeout.setInterval(qMin(browseTimeout() * qMax(1, path.count('/')), connectTimeout() * 1000));
+    connect(&timeout, SIGNAL(timeout()), &loop, SLOT(quit()));
+    timeout.start();
     helper.beginLater();
     // Using an event loop is okay in this case, because the kio slave doesn't get
     // any signals from outside.
     loop.exec();
-    if ( ok ) {
-        *ok = helper.success();
+    if ( m_connectionLost ) {
+        m_connectionLost = false;
+        error(ERR_CONNECTION_BROKEN, m_connection->host().hostname);
+        return false;
+    }
+    if ( ! timeout.isActive() ) {
+        error(ERR_SERVER_TIMEOUT, i18n("Connection timed out."));
+        return false;
+    }
+    if ( exists ) {
+        *exists = helper.success();
     }
-    return helper.result();
+    *iter = helper.result();
+    return true;
 }
 
 void InfinityProtocol::listDir(const KUrl &url)
@@ -368,10 +524,6 @@ void InfinityProtocol::listDir(const KUrl &url)
 
     OrgKdeKDirNotifyInterface::emitEnteredDirectory(url.url());
 
-    if ( ! doConnect(Peer(url)) ) {
-        return;
-    }
-
     if ( url.path().isEmpty() ) {
         KUrl newUrl(url);
         newUrl.setPath("/");
@@ -380,13 +532,35 @@ void InfinityProtocol::listDir(const KUrl &url)
         return;
     }
 
-    QInfinity::BrowserIter iter = iterForUrl(url);
+    QStringList entries;
+    if ( listThroughNotifier(url, &entries) ) {
+        foreach ( const QString& item, entries ) {
+            const bool isDirectory = item.endsWith('/');
+            UDSEntry entry;
+            entry.insert( KIO::UDSEntry::UDS_NAME, isDirectory ? item.left(item.length() - 1) : item );
+            entry.insert( KIO::UDSEntry::UDS_FILE_TYPE, isDirectory ? S_IFDIR : S_IFREG );
+            entry.insert( KIO::UDSEntry::UDS_ACCESS, 07777 );
+            listEntry(entry, false);
+        }
+        listEntry(UDSEntry(), true);
+        finished();
+        return;
+    }
+
+    if ( ! doConnect(Peer(url)) ) {
+        return;
+    }
+
+    QInfinity::BrowserIter iter(*browser());
+    if ( ! iterForUrl(url, &iter) ) {
+        return;
+    }
 
     if ( ! iter.isExplored() ) {
         ExploreRequest* req = iter.explore();
         connect(req, SIGNAL(finished(ExploreRequest*)), this, SIGNAL(requestSuccessful(NodeRequest*)));
         connect(req, SIGNAL(failed(GError*)), this, SIGNAL(requestError(GError*)));
-        if ( ! waitForCompletion() ) {
+        if ( ! waitForCompletion(BrowseRequest) ) {
             return;
         }
     }
@@ -407,16 +581,48 @@ void InfinityProtocol::listDir(const KUrl &url)
     finished();
 }
 
-bool InfinityProtocol::waitForCompletion()
+bool InfinityProtocol::listThroughNotifier(const KUrl& url, QStringList* entries)
+{
+    if ( isConnectedTo(Peer(url)) ) {
+        // we have our own connection already, using it is faster
+        return false;
+    }
+    QDBusMessage call = QDBusMessage::createMethodCall("org.kde.infinotenotifier", "/Browser",
+                                                       "org.kde.infinotenotifier.Browser", "listDirectory");
+    call << url.url();
+    const QDBusMessage reply = QDBusConnection::sessionBus().call(call, QDBus::Block, connectTimeout() * 1000);
+    if ( reply.type() != QDBusMessage::ReplyMessage || reply.arguments().isEmpty() ) {
+        kDebug() << "notifier could not list" << url << ":" << reply.errorMessage();
+        return false;
+    }
+    *entries = reply.arguments().first().toStringList();
+    return true;
+}
+
+bool InfinityProtocol::waitForCompletion(RequestKind kind)
 {
+    if ( m_connectionLost ) {
+        // The connection broke before the request could even be sent
+        m_connectionLost = false;
+        error(ERR_CONNECTION_BROKEN, m_connection ? m_connection->host().hostname : QString());
+        return false;
+    }
+
     QEventLoop loop;
 
-    // Set up the timeout connection
+    // Set up the timeout connection. For browsing, the configured timeout is only used as an
+    // upper bound; usually the request will be given up earlier, based on how fast the server
+    // replied before. Transfers take as long as their size requires, so they get the full timeout.
     QTimer timeout;
     timeout.setSingleShot(true);
-    timeout.setInterval(connectTimeout() * 1000);
+    timeout.setInterval(kind == BrowseRequest ? browseTimeout() : connectTimeout() * 1000);
     connect(&timeout, SIGNAL(timeout()), &loop, SLOT(quit()));
     timeout.start();
+    QTime elapsed;
+    elapsed.start();
+
+    // Stop waiting immediately if the connection goes away
+    connect(this, SIGNAL(connectionLost()), &loop, SLOT(quit()));
 
     // Set up the connection for handling an error
     connect(this, SIGNAL(requestError(GError*)), &loop, SLOT(quit()));
@@ -427,6 +633,12 @@ bool InfinityProtocol::waitForCompletion()
     // Start waiting.
     loop.exec();
 
+    if ( m_connectionLost ) {
+        m_connectionLost = false;
+        error(ERR_CONNECTION_BROKEN, m_connection->host().hostname);
+        return false;
+    }
+
     if ( ! timeout.isActive() ) {
         // If the timer timed out (i.e. is not running any more), connecting failed.
         error(ERR_SERVER_TIMEOUT, i18n("Connection timed out."));
@@ -439,9 +651,17 @@ bool InfinityProtocol::waitForCompletion()
         m_lastError.clear();
         return false;
     }
+    if ( kind == BrowseRequest ) {
+        m_latency.addSample(elapsed.elapsed());
+    }
     return true;
 }
 
+int InfinityProtocol::browseTimeout() const
+{
+    return m_latency.timeout(minimumRequestTimeout, connectTimeout() * 1000);
+}
+
 QInfinity::Browser* InfinityProtocol::browser() const
 {
     return m_browserModel->browsers().first();
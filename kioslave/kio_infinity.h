@@ -28,6 +28,9 @@
 #include <kio/global.h>
 #include <kio/slavebase.h>
 
+#include <QVector>
+#include <QHash>
+
 #include <libqinfinity/browsermodel.h>
 #include <libqinfinity/browseriter.h>
 
@@ -39,6 +42,7 @@ namespace QInfinity {
 
 using QInfinity::NodeRequest;
 using QInfinity::BrowserIter;
+using Kobby::Connection;
 
 /**
  * @brief Represents a host/port pair.
@@ -49,7 +53,9 @@ struct Peer {
         , port(port == -1 ? 6523 : port) { };
     Peer(const KUrl& url)
         : hostname(url.host())
-        , port(url.port() == -1 ? 6523 : url.port()) { };
+        , port(url.port() == -1 ? 6523 : url.port())
+        , userName(url.user())
+        , password(url.pass()) { };
     Peer()
         : hostname(QString())
         , port(-1) { };
@@ -61,6 +67,41 @@ struct Peer {
     }
     QString hostname;
     int port;
+    // Credentials given in the URL, if any; not relevant for comparing peers
+    QString userName;
+    QString password;
+};
+
+/**
+ * @brief Keeps track of how long recent requests to the server took.
+ * Used to derive request timeouts from the observed latency instead of
+ * always waiting for the full configured timeout.
+ */
+class LatencyTracker {
+public:
+    LatencyTracker();
+
+    /**
+     * @brief Record the round trip time of a request which completed successfully.
+     */
+    void addSample(int msecs);
+
+    /**
+     * @brief Forget all samples, e.g. after reconnecting to a different server.
+     */
+    void clear();
+
+    /**
+     * @brief Timeout to use for the next request.
+     * This is a multiple of the 95th percentile of the recent round trip times,
+     * clamped to [minimum, maximum]. If there are not enough samples yet, maximum is returned.
+     */
+    int timeout(int minimum, int maximum) const;
+
+private:
+    // Ring buffer of the most recent round trip times, in milliseconds
+    QVector<int> m_samples;
+    int m_next;
 };
 
 /**
@@ -93,8 +134,13 @@ signals:
     // This signal is be emitted if an operation was successful.
     void requestSuccessful(NodeRequest* req);
 
+    // Emitted when the connection to the server breaks while it is in use.
+    // Everything waiting for the server should stop waiting when this is emitted.
+    void connectionLost();
+
 public slots:
     void slotRequestError(GError* error);
+    void slotConnectionStatusChanged(Connection* connection, QInfinity::XmlConnection::Status status);
 
 private:
     // Checks if a connection to the given peer is open already.
@@ -109,25 +155,60 @@ private:
 
     // Finds a QInfinity::BrowserIter for the given URL. This operation requires
     // communication with the server and is very expensive.
-    // You can provide an "ok" boolean to check if the request succeeded,
-    // in case you are not sure it does. If ok is false, the returned
-    // iter is invalid.
-    QInfinity::BrowserIter iterForUrl(const KUrl& url, bool* ok = 0);
+    // Returns false if the server did not answer in time or the connection broke;
+    // the error was reported already then, and the slave function should just return.
+    // Otherwise, you can provide an "exists" boolean to check whether the node
+    // was found, in case you are not sure it is there. If exists is false, iter is invalid.
+    bool iterForUrl(const KUrl& url, QInfinity::BrowserIter* iter, bool* exists = 0);
 
     // Get the browser for the currently established connection.
     // Only call this if connected.
     QInfinity::Browser* browser() const;
 
+    enum RequestKind {
+        // Exploring a directory; small, and answered quickly by a healthy server
+        BrowseRequest,
+        // Anything else, e.g. adding a note with its contents, which may take long for big documents
+        TransferRequest
+    };
+
     // Waits for a request finish (as signaled by requestSuccessful() / requestError()),
-    // and reacts to errors accordingly.
+    // and reacts to errors accordingly. For browse requests, the timeout is derived from
+    // the latency of previous browse requests (see browseTimeout()); other requests wait
+    // for the configured timeout.
+    // If the connection breaks while waiting, this returns immediately.
     // A slave function (such as put()) should just abort (return) if this returns false.
-    bool waitForCompletion();
+    bool waitForCompletion(RequestKind kind = TransferRequest);
+
+    // Timeout in ms for a small request like exploring a directory, derived from how fast
+    // the server answered such requests before. Bounded by the configured timeout.
+    int browseTimeout() const;
+
+    // Drops the current connection, such that the next request will reconnect.
+    void resetConnection();
+
+    // Makes the credentials for the peer available to the connection. Passwords from URLs
+    // are cached in kpasswdserver, so later requests (also from other slaves) can use them.
+    void setupCredentials(const Peer& peer);
+
+    // Asks the notifier daemon to list the directory at url, using its connection to
+    // the server, so this slave doesn't have to connect itself just for browsing.
+    // Directories in the returned entries have a trailing slash.
+    // Returns false if the notifier is not running or could not list the directory;
+    // the caller should then do the request itself.
+    bool listThroughNotifier(const KUrl& url, QStringList* entries);
 
     QSharedPointer<Kobby::Connection> m_connection;
     QSharedPointer<QInfinity::BrowserModel> m_browserModel;
     Kobby::NotePlugin* m_notePlugin;
     Peer m_connectedTo;
     QString m_lastError;
+    LatencyTracker m_latency;
+    // How long connecting to each host took, by "host:port". Kept across connections,
+    // unlike m_latency, since doConnect() always starts with a fresh connection.
+    QHash<QString, LatencyTracker> m_connectLatency;
+    // Set when the connection broke while a request was running
+    bool m_connectionLost;
 };
 
 
@@ -0,0 +1,378 @@
+/* This file is part of the Kobby plugin
+ * Copyright (C) 2013 Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "authorshipmap.h"
+
+#include <KDebug>
+
+#include <QDataStream>
+#include <QPair>
+
+AuthorshipMap::AuthorshipMap()
+{
+    m_authors << QString();
+    m_authorIds[QString()] = NoAuthor;
+    m_lines.resize(1);
+}
+
+void AuthorshipMap::reset(const QVector<int>& lineLengths)
+{
+    m_lines.clear();
+    m_lines.resize(qMax(1, lineLengths.size()));
+    for ( int i = 0; i < lineLengths.size(); i++ ) {
+        Line& line = m_lines[i];
+        line.length = lineLengths.at(i);
+        if ( line.length > 0 ) {
+            line.runs << Run(0, NoAuthor);
+        }
+    }
+}
+
+int AuthorshipMap::authorId(const QString& name)
+{
+    QHash<QString, int>::const_iterator it = m_authorIds.constFind(name);
+    if ( it != m_authorIds.constEnd() ) {
+        return it.value();
+    }
+    m_authors << name;
+    m_authorIds[name] = m_authors.size() - 1;
+    return m_authors.size() - 1;
+}
+
+QString AuthorshipMap::authorName(int author) const
+{
+    return m_authors.value(author);
+}
+
+QStringList AuthorshipMap::authors() const
+{
+    // the first one is NoAuthor
+    return m_authors.mid(1);
+}
+
+int AuthorshipMap::runAt(const Line& line, int column)
+{
+    // binary search for the last run starting at or before column
+    int low = 0;
+    int high = line.runs.size();
+    while ( low < high ) {
+        const int middle = ( low + high ) / 2;
+        if ( line.runs.at(middle).start <= column ) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low - 1;
+}
+
+int AuthorshipMap::splitAt(Line& line, int column)
+{
+    if ( column >= line.length ) {
+        return line.runs.size();
+    }
+    const int index = runAt(line, column);
+    if ( line.runs.at(index).start == column ) {
+        return index;
+    }
+    line.runs.insert(index + 1, Run(column, line.runs.at(index).author));
+    return index + 1;
+}
+
+void AuthorshipMap::joinAt(Line& line, int index)
+{
+    if ( index > 0 && index < line.runs.size() && line.runs.at(index - 1).author == line.runs.at(index).author ) {
+        line.runs.remove(index);
+    }
+}
+
+void AuthorshipMap::insertIntoLine(Line& line, int column, int length, int author)
+{
+    if ( length <= 0 ) {
+        return;
+    }
+    const int index = splitAt(line, column);
+    for ( int i = index; i < line.runs.size(); i++ ) {
+        line.runs[i].start += length;
+    }
+    line.runs.insert(index, Run(column, author));
+    line.length += length;
+    line.mainAuthor = -1;
+    joinAt(line, index + 1);
+    joinAt(line, index);
+}
+
+AuthorshipMap::Line AuthorshipMap::takeTail(Line& line, int column)
+{
+    Line tail;
+    const int index = splitAt(line, column);
+    tail.runs = line.runs.mid(index);
+    for ( int i = 0; i < tail.runs.size(); i++ ) {
+        tail.runs[i].start -= column;
+    }
+    tail.length = line.length - column;
+    line.runs.resize(index);
+    line.length = column;
+    line.mainAuthor = -1;
+    return tail;
+}
+
+void AuthorshipMap::append(Line& line, const Line& tail)
+{
+    const int index = line.runs.size();
+    foreach ( const Run& run, tail.runs ) {
+        line.runs << Run(run.start + line.length, run.author);
+    }
+    line.length += tail.length;
+    line.mainAuthor = -1;
+    joinAt(line, index);
+}
+
+void AuthorshipMap::insert(const KTextEditor::Cursor& position, const QString& text, const QString& author)
+{
+    if ( position.line() < 0 || position.line() >= m_lines.size() ) {
+        kWarning() << "insertion at" << position << "is outside of the document, which has" << m_lines.size() << "lines";
+        return;
+    }
+    const int id = authorId(author);
+    const int line = position.line();
+    const int column = qBound(0, position.column(), m_lines.at(line).length);
+    const QStringList parts = text.split('\n');
+    if ( parts.size() == 1 ) {
+        insertIntoLine(m_lines[line], column, text.length(), id);
+        return;
+    }
+    const Line tail = takeTail(m_lines[line], column);
+    insertIntoLine(m_lines[line], column, parts.first().length(), id);
+    QVector<Line> newLines(parts.size() - 1);
+    for ( int i = 1; i < parts.size(); i++ ) {
+        insertIntoLine(newLines[i - 1], 0, parts.at(i).length(), id);
+    }
+    append(newLines.last(), tail);
+    m_lines.insert(line + 1, newLines.size(), Line());
+    for ( int i = 0; i < newLines.size(); i++ ) {
+        m_lines[line + 1 + i] = newLines.at(i);
+    }
+}
+
+void AuthorshipMap::remove(const KTextEditor::Range& range)
+{
+    const int startLine = range.start().line();
+    const int endLine = qMin(range.end().line(), m_lines.size() - 1);
+    if ( startLine < 0 || startLine >= m_lines.size() ) {
+        kWarning() << "removal of" << range << "is outside of the document, which has" << m_lines.size() << "lines";
+        return;
+    }
+    const int startColumn = qBound(0, range.start().column(), m_lines.at(startLine).length);
+    int endColumn = qBound(0, range.end().column(), m_lines.at(endLine).length);
+    if ( startLine == endLine ) {
+        endColumn = qMax(startColumn, endColumn);
+    }
+    const Line tail = takeTail(m_lines[endLine], endColumn);
+    takeTail(m_lines[startLine], startColumn);
+    append(m_lines[startLine], tail);
+    m_lines.remove(startLine + 1, endLine - startLine);
+}
+
+QString AuthorshipMap::authorAt(const KTextEditor::Cursor& position) const
+{
+    if ( position.line() < 0 || position.line() >= m_lines.size() ) {
+        return QString();
+    }
+    const Line& line = m_lines.at(position.line());
+    if ( line.runs.isEmpty() ) {
+        return QString();
+    }
+    const int column = qBound(0, position.column(), line.length - 1);
+    return m_authors.at(line.runs.at(runAt(line, column)).author);
+}
+
+QString AuthorshipMap::authorForLine(int lineNumber) const
+{
+    if ( lineNumber < 0 || lineNumber >= m_lines.size() ) {
+        return QString();
+    }
+    const Line& line = m_lines.at(lineNumber);
+    if ( line.mainAuthor == -1 ) {
+        QHash<int, int> written;
+        for ( int i = 0; i < line.runs.size(); i++ ) {
+            const int end = i + 1 < line.runs.size() ? line.runs.at(i + 1).start : line.length;
+            written[line.runs.at(i).author] += end - line.runs.at(i).start;
+        }
+        line.mainAuthor = NoAuthor;
+        int most = 0;
+        for ( QHash<int, int>::const_iterator it = written.constBegin(); it != written.constEnd(); ++it ) {
+            if ( it.key() != NoAuthor && it.value() > most ) {
+                most = it.value();
+                line.mainAuthor = it.key();
+            }
+        }
+    }
+    return m_authors.at(line.mainAuthor);
+}
+
+QStringList AuthorshipMap::authorsInRange(const KTextEditor::Range& range) const
+{
+    QStringList authors;
+    const int endLine = qMin(range.end().line(), m_lines.size() - 1);
+    for ( int lineNumber = qMax(0, range.start().line()); lineNumber <= endLine; lineNumber++ ) {
+        const Line& line = m_lines.at(lineNumber);
+        int first = 0;
+        if ( lineNumber == range.start().line() ) {
+            first = qMax(0, runAt(line, range.start().column()));
+        }
+        for ( int i = first; i < line.runs.size(); i++ ) {
+            const Run& run = line.runs.at(i);
+            if ( lineNumber == range.end().line() && run.start >= range.end().column() ) {
+                break;
+            }
+            const QString& name = m_authors.at(run.author);
+            if ( run.author != NoAuthor && ! authors.contains(name) ) {
+                authors << name;
+            }
+        }
+    }
+    return authors;
+}
+
+int AuthorshipMap::lineCount() const
+{
+    return m_lines.size();
+}
+
+int AuthorshipMap::lineLength(int line) const
+{
+    return m_lines.at(line).length;
+}
+
+const AuthorshipMap::Runs& AuthorshipMap::runs(int line) const
+{
+    return m_lines.at(line).runs;
+}
+
+/// Increase when the format written by AuthorshipMap::save() changes
+static const quint8 authorshipFormatVersion = 1;
+
+QByteArray AuthorshipMap::save() const
+{
+    // Runs over the whole text, as (length, author); adjacent ones have different authors
+    QList< QPair<quint32, quint32> > runs;
+    for ( int lineNumber = 0; lineNumber < m_lines.size(); lineNumber++ ) {
+        const Line& line = m_lines.at(lineNumber);
+        for ( int i = 0; i < line.runs.size(); i++ ) {
+            const Run& run = line.runs.at(i);
+            const int end = i + 1 < line.runs.size() ? line.runs.at(i + 1).start : line.length;
+            if ( ! runs.isEmpty() && runs.last().second == (quint32) run.author ) {
+                runs.last().first += end - run.start;
+            }
+            else {
+                runs << qMakePair<quint32, quint32>(end - run.start, run.author);
+            }
+        }
+        if ( lineNumber + 1 < m_lines.size() ) {
+            // the line end goes with whatever precedes it
+            if ( runs.isEmpty() ) {
+                runs << qMakePair<quint32, quint32>(0, NoAuthor);
+            }
+            runs.last().first += 1;
+        }
+    }
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << authorshipFormatVersion << m_authors << (quint32) runs.size();
+    typedef QPair<quint32, quint32> FlatRun;
+    foreach ( const FlatRun& run, runs ) {
+        stream << run.first << run.second;
+    }
+    return data;
+}
+
+bool AuthorshipMap::restore(const QByteArray& data, const QVector<int>& lineLengths)
+{
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_4_6);
+    quint8 version = 0;
+    QStringList authors;
+    quint32 count = 0;
+    stream >> version >> authors >> count;
+    if ( stream.status() != QDataStream::Ok || version != authorshipFormatVersion || authors.isEmpty() ) {
+        kDebug() << "invalid authorship data, version" << version;
+        return false;
+    }
+    qint64 expectedLength = qMax(0, lineLengths.size() - 1);
+    foreach ( int length, lineLengths ) {
+        expectedLength += length;
+    }
+    // Stored author ids are translated to the ids used by this map, which are only
+    // added once everything was read successfully.
+    QVector<quint32> lengths;
+    QVector<quint32> storedAuthors;
+    qint64 totalLength = 0;
+    for ( quint32 i = 0; i < count && totalLength <= expectedLength; i++ ) {
+        quint32 length, author;
+        stream >> length >> author;
+        if ( stream.status() != QDataStream::Ok || author >= (quint32) authors.size() ) {
+            kDebug() << "invalid authorship data";
+            return false;
+        }
+        lengths << length;
+        storedAuthors << author;
+        totalLength += length;
+    }
+    if ( totalLength != expectedLength ) {
+        kDebug() << "stored authorship is for a text of length" << totalLength << "not" << expectedLength;
+        return false;
+    }
+
+    QVector<int> ids(authors.size());
+    for ( int i = 0; i < authors.size(); i++ ) {
+        ids[i] = authorId(authors.at(i));
+    }
+    QVector<Line> lines(qMax(1, lineLengths.size()));
+    int run = 0;
+    // what is left of the current run
+    quint32 remaining = lengths.isEmpty() ? 0 : lengths.first();
+    for ( int lineNumber = 0; lineNumber < lineLengths.size(); lineNumber++ ) {
+        Line& line = lines[lineNumber];
+        line.length = lineLengths.at(lineNumber);
+        // the line end counts as one more character, it is not part of the line though
+        int column = 0;
+        const int end = lineNumber + 1 < lineLengths.size() ? line.length + 1 : line.length;
+        while ( column < end ) {
+            while ( remaining == 0 ) {
+                remaining = lengths.at(++run);
+            }
+            const int author = ids.at(storedAuthors.at(run));
+            if ( column < line.length && ( line.runs.isEmpty() || line.runs.last().author != author ) ) {
+                line.runs << Run(column, author);
+            }
+            const int taken = qMin<qint64>(remaining, end - column);
+            column += taken;
+            remaining -= taken;
+        }
+    }
+    m_lines = lines;
+    return true;
+}
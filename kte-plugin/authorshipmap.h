@@ -0,0 +1,149 @@
+/* This file is part of the Kobby plugin
+ * Copyright (C) 2013 Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef AUTHORSHIPMAP_H
+#define AUTHORSHIPMAP_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+
+#include <KTextEditor/Range>
+
+/**
+ * @brief Remembers who wrote which part of a document's text.
+ *
+ * For each line, the authorship is stored as a list of runs, sorted by column: a run
+ * starts at some column, and reaches to the start of the next one, or to the end of
+ * the line. Adjacent runs always have different authors, so a line typed by one person
+ * is a single run. Looking up the author of a position thus is a binary search in a
+ * short list, and the main author of a line is cached until the line is changed.
+ *
+ * The map must be told about every change to the text with insert() and remove(),
+ * in the order the changes are applied. All positions are KTextEditor cursors.
+ *
+ * With save() and restore(), the map can be stored as a list of (length, author) pairs
+ * running over the whole text; line ends belong to the run they are in, so
+ * text written by one person in one go takes a single pair however many lines it has.
+ */
+class AuthorshipMap {
+public:
+    /// Id of text nobody is known to have written, e.g. the initial contents
+    static const int NoAuthor = 0;
+
+    struct Run {
+        Run() : start(0), author(NoAuthor) { };
+        Run(int start, int author) : start(start), author(author) { };
+        /// The column this run starts at
+        int start;
+        int author;
+    };
+    typedef QVector<Run> Runs;
+
+    AuthorshipMap();
+
+    /**
+     * @brief Forget all authorship; the text consists of lines of the given lengths, written by nobody.
+     */
+    void reset(const QVector<int>& lineLengths);
+
+    /**
+     * @brief Record that @p author inserted @p text at @p position.
+     */
+    void insert(const KTextEditor::Cursor& position, const QString& text, const QString& author);
+
+    /**
+     * @brief Record that the text in @p range was removed.
+     */
+    void remove(const KTextEditor::Range& range);
+
+    /**
+     * @brief The author of the character at @p position, or of the last one in the line
+     * if @p position is at its end. Empty if nobody is known to have written it.
+     */
+    QString authorAt(const KTextEditor::Cursor& position) const;
+
+    /**
+     * @brief The person who wrote most of line @p line; empty if nobody wrote anything in it.
+     * Text not written by anyone only counts if nothing else is in the line.
+     */
+    QString authorForLine(int line) const;
+
+    /**
+     * @brief Everyone who wrote something in @p range, in the order of appearance.
+     */
+    QStringList authorsInRange(const KTextEditor::Range& range) const;
+
+    int lineCount() const;
+    int lineLength(int line) const;
+    const Runs& runs(int line) const;
+    /**
+     * @brief The name of the author with the given id, as used in the runs.
+     */
+    QString authorName(int author) const;
+    /**
+     * @brief The names of everyone who wrote something since the last reset(), in no particular order.
+     */
+    QStringList authors() const;
+
+    /**
+     * @brief The authorship as a compact byte array, for restore().
+     */
+    QByteArray save() const;
+
+    /**
+     * @brief Replaces all authorship by what was stored with save().
+     * @param lineLengths The lengths of the document's lines, which must add up to the length
+     *                    of the text at the time of saving.
+     * @return false if @p data is invalid or does not fit the text; nothing is changed then.
+     */
+    bool restore(const QByteArray& data, const QVector<int>& lineLengths);
+
+private:
+    struct Line {
+        Line() : length(0), mainAuthor(-1) { };
+        Runs runs;
+        int length;
+        /// Cached result of authorForLine(), -1 if unknown
+        mutable int mainAuthor;
+    };
+
+    int authorId(const QString& name);
+    /// Makes sure a run starts at @p column, and returns its index
+    static int splitAt(Line& line, int column);
+    /// Merges the run at @p index into the previous one, if they have the same author
+    static void joinAt(Line& line, int index);
+    static void insertIntoLine(Line& line, int column, int length, int author);
+    /// Removes everything from @p column on from @p line, and returns it as a line of its own
+    static Line takeTail(Line& line, int column);
+    static void append(Line& line, const Line& tail);
+    static int runAt(const Line& line, int column);
+
+    QVector<Line> m_lines;
+    /// Author names, by id
+    QStringList m_authors;
+    QHash<QString, int> m_authorIds;
+};
+
+#endif // AUTHORSHIPMAP_H
@@ -25,30 +25,49 @@
 #include "common/utils.h"
 
 #include <KTextEditor/MovingInterface>
+#include <KTextEditor/MovingRange>
+#include <KTextEditor/CoordinatesToCursorInterface>
+#include <KTextEditor/View>
 #include <KConfigGroup>
 #include <KConfig>
 #include <KLocalizedString>
+#include <KStandardDirs>
+#include <KUrl>
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QFile>
+#include <QPair>
 
 DocumentChangeTracker::DocumentChangeTracker(ManagedDocument* const document)
     : QObject(document)
     , m_document(document)
     , m_iface(qobject_cast<KTextEditor::MovingInterface*>(document->document()))
+    , m_highlight(false)
+    , m_textChanged(false)
 {
     kDebug() << "change tracker created for" << document->document()->url() << "moving interface:" << m_iface;
     connect(m_document, SIGNAL(synchronizationBegins(ManagedDocument*)),
             this, SLOT(setupSignals()));
+    connect(m_document->document(), SIGNAL(viewCreated(KTextEditor::Document*,KTextEditor::View*)),
+            this, SLOT(scheduleUpdate()));
     m_existingColors[QLatin1String("Initial document contents")] = QColor(Qt::transparent);
+    m_updateTimer.setSingleShot(true);
+    m_updateTimer.setInterval(0);
+    connect(&m_updateTimer, SIGNAL(timeout()), this, SLOT(updateHighlight()));
 }
 
 void DocumentChangeTracker::setupSignals()
 {
+    // The document's current text is the starting point, changes are tracked from now on.
+    m_authorship.reset(lineLengths());
+    connect(m_document->textBuffer(), SIGNAL(textEdited(KTextEditor::Range,QInfinity::User*,bool)),
+            this, SLOT(textEdited(KTextEditor::Range,QInfinity::User*,bool)));
+
     KConfig config("ktecollaborative");
-    if ( config.group("notifications").readEntry("highlightBackground", true) ) {
-        connect(m_document->textBuffer(), SIGNAL(localChangedText(KTextEditor::Range,QInfinity::User*,bool)),
-                this, SLOT(userChangedText(KTextEditor::Range,QInfinity::User*,bool)));
-        connect(m_document->textBuffer(), SIGNAL(remoteChangedText(KTextEditor::Range,QInfinity::User*,bool)),
-                this, SLOT(userChangedText(KTextEditor::Range,QInfinity::User*,bool)));
-    }
+    m_highlight = config.group("notifications").readEntry("highlightBackground", true);
+    m_textChanged = true;
+    scheduleUpdate();
 }
 
 KTextEditor::Document* DocumentChangeTracker::kDocument() const
@@ -58,156 +77,234 @@ KTextEditor::Document* DocumentChangeTracker::kDocument() const
 
 void DocumentChangeTracker::clearHighlight()
 {
-    qDeleteAll(m_ranges);
-    m_ranges.clear();
+    m_authorship.reset(lineLengths());
+    m_textChanged = true;
+    scheduleUpdate();
 }
 
-void DocumentChangeTracker::cleanupRanges()
+QString DocumentChangeTracker::userForCursor(const KTextEditor::Cursor& position) const
 {
-    // TODO: Could join ranges in some cases. Worth it?
-    for ( int i = 0; i < m_ranges.size(); i++ ) {
-        KTextEditor::MovingRange* r = m_ranges.at(i);
-        if ( r->isEmpty() ) {
-            m_ranges.removeAt(i);
-            delete r;
-            i -= 1;
-        }
+    const QString name = m_authorship.authorAt(position);
+    if ( name.isEmpty() ) {
+        return i18nc("Refers to a person which is not known", "unknown user");
     }
+    return name;
 }
 
-QString DocumentChangeTracker::userForCursor(const KTextEditor::Cursor& position) const
+QString DocumentChangeTracker::authorForLine(int line) const
+{
+    return m_authorship.authorForLine(line);
+}
+
+QStringList DocumentChangeTracker::authorsInRange(const KTextEditor::Range& range) const
+{
+    return m_authorship.authorsInRange(range);
+}
+
+const AuthorshipMap& DocumentChangeTracker::authorship() const
+{
+    return m_authorship;
+}
+
+QVector<int> DocumentChangeTracker::lineLengths() const
 {
-    foreach ( KTextEditor::MovingRange* range, m_ranges ) {
-        if ( range->contains(position) ) {
-            return range->attribute()->toolTip();
+    QVector<int> lengths(kDocument()->lines());
+    for ( int i = 0; i < lengths.size(); i++ ) {
+        lengths[i] = kDocument()->lineLength(i);
+    }
+    return lengths;
+}
+
+QString DocumentChangeTracker::authorshipFile() const
+{
+    KUrl url = kDocument()->url();
+    url.setUser(QString());
+    url.setPass(QString());
+    const QByteArray key = QCryptographicHash::hash(url.url().toUtf8(), QCryptographicHash::Sha1).toHex();
+    return KStandardDirs::locateLocal("data", "ktecollaborative/authorship/" + QString::fromLatin1(key));
+}
+
+QByteArray DocumentChangeTracker::textHash() const
+{
+    return QCryptographicHash::hash(kDocument()->text().toUtf8(), QCryptographicHash::Sha1);
+}
+
+void DocumentChangeTracker::saveAuthorship() const
+{
+    QFile file(authorshipFile());
+    if ( ! file.open(QIODevice::WriteOnly) ) {
+        kWarning() << "failed to open" << file.fileName() << "for writing";
+        return;
+    }
+    QDataStream stream(&file);
+    stream << textHash() << m_authorship.save();
+    kDebug() << "saved authorship of" << kDocument()->url() << "to" << file.fileName();
+}
+
+bool DocumentChangeTracker::restoreAuthorship()
+{
+    QFile file(authorshipFile());
+    if ( ! file.open(QIODevice::ReadOnly) ) {
+        return false;
+    }
+    QDataStream stream(&file);
+    QByteArray hash;
+    QByteArray data;
+    stream >> hash >> data;
+    if ( stream.status() != QDataStream::Ok || hash != textHash() ) {
+        kDebug() << "the text of" << kDocument()->url() << "changed since its authorship was saved";
+        return false;
+    }
+    if ( ! m_authorship.restore(data, lineLengths()) ) {
+        return false;
+    }
+    foreach ( const QString& name, m_authorship.authors() ) {
+        attributeForUser(name);
+    }
+    m_textChanged = true;
+    scheduleUpdate();
+    return true;
+}
+
+void DocumentChangeTracker::textEdited(const KTextEditor::Range& range, QInfinity::User* user, bool removal)
+{
+    if ( removal ) {
+        m_authorship.remove(range);
+    }
+    else {
+        const QString name = user ? user->name() : QString();
+        m_authorship.insert(range.start(), kDocument()->text(range), name);
+        if ( ! name.isEmpty() ) {
+            attributeForUser(name);
         }
     }
-    return i18nc("Refers to a person which is not known", "unknown user");
+    m_textChanged = true;
+    scheduleUpdate();
 }
 
-KTextEditor::MovingRange* DocumentChangeTracker::addHighlightedRange(const QString& name, const KTextEditor::Range& range, const QColor& color)
+KTextEditor::Attribute::Ptr DocumentChangeTracker::attributeForUser(const QString& name)
 {
-    // We allow empty ranges here, and invalidate them ourselves on the next insertion.
-    KTextEditor::MovingRange* r = iface()->newMovingRange(range, KTextEditor::MovingRange::DoNotExpand,
-                                                          KTextEditor::MovingRange::AllowEmpty);
+    QHash<QString, KTextEditor::Attribute::Ptr>::const_iterator it = m_attributes.constFind(name);
+    if ( it != m_attributes.constEnd() ) {
+        return it.value();
+    }
+    const QColor& color = ColorHelper::colorForUsername(name, kDocument()->activeView(), m_existingColors);
     KTextEditor::Attribute::Ptr attrib(new KTextEditor::Attribute);
     attrib->setBackground(color);
     attrib->setToolTip(name);
-    r->setAttribute(attrib);
-    m_ranges << r;
-    if ( ! name.isEmpty() && ( ! m_existingColors.contains(name) || m_existingColors[name] != color ) ) {
+    m_attributes[name] = attrib;
+    if ( ! m_existingColors.contains(name) || m_existingColors[name] != color ) {
         m_existingColors[name] = color;
         emit colorTableChanged();
     }
-    return r;
+    return attrib;
 }
 
-void DocumentChangeTracker::userChangedText(const KTextEditor::Range& range, QInfinity::User* user, bool removal)
+void DocumentChangeTracker::scheduleUpdate()
 {
-    // Nothing to do for removals, ranges will shrink automatically
-    if ( ! iface() || ! user || removal ) {
-        return;
-    }
-    cleanupRanges();
-    const int startLine = range.start().line();
-    const int endLine = range.end().line();
-    if ( startLine != endLine ) {
-        // If the range spans multiple lines, add multiple moving ranges to avoid
-        // highlighting the newlines.
-        // TODO maybe we want this behaviour to be configurable?
-        for ( int line = startLine; line <= endLine; line++ ) {
-            KTextEditor::Range newlineRange(line, m_document->document()->lineLength(line), line + 1, 0);
-            if ( KTextEditor::MovingRange* existing = rangeAt(newlineRange) ) {
-                if ( existing->contains(newlineRange) ) {
-                    kDebug() << "splitting range" << *existing << newlineRange;
-                    KTextEditor::Range newRange(KTextEditor::Cursor(existing->end().line(), 0),
-                                                KTextEditor::Cursor(existing->end().line(), existing->end().column()));
-                    kDebug() << newRange;
-                    addHighlightedRange(QString(), newRange,
-                                        existing->attribute()->background().color());
-                    existing->setRange(existing->start(),
-                                    KTextEditor::Cursor(existing->start().line(),
-                                                        m_document->document()->lineLength(existing->start().line()))
-                                    );
-                }
-            }
-            const int lineSize = m_document->document()->lineLength(line);
-            if ( lineSize == 0 ) {
-                // do not create empty highlight ranges
-                continue;
-            }
-            const KTextEditor::Cursor lineEnd(line, lineSize);
-            KTextEditor::Range lineRange;
-            if ( line == startLine ) {
-                lineRange.setRange(range.start(), lineEnd);
-            }
-            else if ( line == endLine ) {
-                lineRange.setRange(KTextEditor::Cursor(line, 0), range.end());
-            }
-            else {
-                lineRange.setRange(KTextEditor::Cursor(line, 0), lineEnd);
-            }
-            // Off-load the actual work of highlighting the line to another call
-            Q_ASSERT(lineRange.start().line() == lineRange.end().line());
-            userChangedText(lineRange, user, removal);
-        }
-        return;
+    if ( ! m_updateTimer.isActive() ) {
+        m_updateTimer.start();
     }
+}
 
-    const QColor& userColor = ColorHelper::colorForUsername(user->name(), m_document->document()->activeView(),
-                                                            m_existingColors);
+bool DocumentChangeTracker::eventFilter(QObject* watched, QEvent* e)
+{
+    if ( e->type() == QEvent::Resize && m_viewHighlights.contains(watched) ) {
+        scheduleUpdate();
+    }
+    return QObject::eventFilter(watched, e);
+}
 
-    KTextEditor::MovingRange* existing = rangeAt(range);
+void DocumentChangeTracker::viewDestroyed(QObject* view)
+{
+    // the document would keep them until it is closed otherwise
+    qDeleteAll(m_viewHighlights.take(view).ranges);
+}
 
-    if ( existing ) {
-        bool colorMatches = existing->attribute()->background().color() == userColor;
-        if ( colorMatches && range.start().line() == range.end().line() ) {
-            if ( existing->contains(range) ) {
-                // The existing range has the same color and contains the insertion.
-                // It will auto-expand, and nothing needs to be done at all.
-                return;
-            }
-            // Expand this range if it matches start or end of the new text
-            if ( existing->start() == range.end() ) {
-                existing->setRange(range.start(), existing->end());
-                return;
-            }
-            else if ( existing->end() == range.start() ) {
-                existing->setRange(existing->start(), range.end());
-                return;
-            }
-            // Should not reach here, if I have understood the interface correctly :)
-            kWarning() << "whops, strange things are happening -- fix me";
-    //             Q_ASSERT(false);
-        }
-        else if ( existing->contains(range) ) {
-            splitRangeForInsertion(existing, range);
-            // the range for the new text will be added below.
-        }
+// The lines which are visible in @p view
+static QPair<int, int> visibleLines(KTextEditor::View* view)
+{
+    const int lastLine = view->document()->lines() - 1;
+    // used if the view can't tell
+    const int lineCount = view->height() / qMax(1, view->fontMetrics().height());
+    KTextEditor::CoordinatesToCursorInterface* iface = qobject_cast<KTextEditor::CoordinatesToCursorInterface*>(view);
+    const KTextEditor::Cursor top = iface ? iface->coordinatesToCursor(QPoint(0, 0)) : KTextEditor::Cursor::invalid();
+    if ( ! top.isValid() ) {
+        const int line = view->cursorPosition().line();
+        return qMakePair(qMax(0, line - lineCount), qMin(lastLine, line + lineCount));
     }
-    addHighlightedRange(user->name(), range, userColor);
+    const KTextEditor::Cursor bottom = iface->coordinatesToCursor(QPoint(0, view->height() - 1));
+    return qMakePair(top.line(), bottom.isValid() ? bottom.line() : qMin(lastLine, top.line() + lineCount));
 }
 
-KTextEditor::MovingRange* DocumentChangeTracker::rangeAt(const KTextEditor::Range& range)
+void DocumentChangeTracker::updateHighlight()
 {
-    foreach ( KTextEditor::MovingRange* existing, m_ranges ) {
-        if ( existing->start() > range.end() || existing->end() < range.start() ) {
+    if ( ! iface() ) {
+        return;
+    }
+    foreach ( KTextEditor::View* view, kDocument()->views() ) {
+        if ( ! m_viewHighlights.contains(view) ) {
+            m_viewHighlights.insert(view, ViewHighlight());
+            connect(view, SIGNAL(destroyed(QObject*)),
+                    this, SLOT(viewDestroyed(QObject*)));
+            connect(view, SIGNAL(verticalScrollPositionChanged(KTextEditor::View*,KTextEditor::Cursor)),
+                    this, SLOT(scheduleUpdate()));
+            view->installEventFilter(this);
+        }
+        ViewHighlight& highlight = m_viewHighlights[view];
+        if ( ! m_highlight ) {
+            highlightLines(view, highlight, -1, -1);
+            continue;
+        }
+        const QPair<int, int> visible = visibleLines(view);
+        if ( ! m_textChanged && highlight.firstLine <= visible.first && highlight.lastLine >= visible.second ) {
+            // still covered, nothing to do
             continue;
         }
-        return existing;
+        // Cover one more screen above and below, so scrolling a bit doesn't require an update.
+        const int margin = visible.second - visible.first + 1;
+        highlightLines(view, highlight, qMax(0, visible.first - margin),
+                       qMin(m_authorship.lineCount() - 1, visible.second + margin));
     }
-    return 0;
+    m_textChanged = false;
 }
 
-void DocumentChangeTracker::splitRangeForInsertion(KTextEditor::MovingRange* existing, const KTextEditor::Range& splitFor)
+void DocumentChangeTracker::highlightLines(KTextEditor::View* view, ViewHighlight& highlight, int firstLine, int lastLine)
 {
-    // split this range; the old range turns into the second part...
-    KTextEditor::Cursor oldStart = existing->start();
-    existing->setRange(splitFor.end(), existing->end());
-    // and a new one is created for the first part
-    KTextEditor::Range firstPartRaw(oldStart, splitFor.start());
-    KTextEditor::MovingRange* r = addHighlightedRange(QString(), firstPartRaw, QColor());
-    r->setAttribute(existing->attribute());
+    int used = 0;
+    for ( int line = qMax(0, firstLine); line <= lastLine && line < m_authorship.lineCount(); line++ ) {
+        const AuthorshipMap::Runs& runs = m_authorship.runs(line);
+        for ( int i = 0; i < runs.size(); i++ ) {
+            if ( runs.at(i).author == AuthorshipMap::NoAuthor ) {
+                continue;
+            }
+            // Ranges never contain line ends, so the newlines are not highlighted.
+            const int end = i + 1 < runs.size() ? runs.at(i + 1).start : m_authorship.lineLength(line);
+            const KTextEditor::Range range(line, runs.at(i).start, line, end);
+            KTextEditor::Attribute::Ptr attrib = attributeForUser(m_authorship.authorName(runs.at(i).author));
+            KTextEditor::MovingRange* r = 0;
+            if ( used < highlight.ranges.size() ) {
+                r = highlight.ranges.at(used);
+                if ( r->toRange() != range ) {
+                    r->setRange(range);
+                }
+            }
+            else {
+                r = iface()->newMovingRange(range, KTextEditor::MovingRange::DoNotExpand,
+                                            KTextEditor::MovingRange::AllowEmpty);
+                r->setView(view);
+                highlight.ranges << r;
+            }
+            if ( r->attribute() != attrib ) {
+                r->setAttribute(attrib);
+            }
+            used++;
+        }
+    }
+    qDeleteAll(highlight.ranges.mid(used));
+    highlight.ranges.erase(highlight.ranges.begin() + used, highlight.ranges.end());
+    highlight.firstLine = firstLine;
+    highlight.lastLine = lastLine;
 }
 
 const QMap<QString, QColor>& DocumentChangeTracker::usedColors() const
@@ -24,13 +24,21 @@
 #define DOCUMENTCHANGETRACKER_H
 
 #include <QObject>
+#include <QHash>
+#include <QMap>
+#include <QColor>
+#include <QTimer>
 
 #include <KTextEditor/Range>
+#include <KTextEditor/Attribute>
+
+#include "authorshipmap.h"
 
 namespace KTextEditor {
     class Document;
+    class View;
     class MovingInterface;
-class MovingRange;
+    class MovingRange;
 }
 
 namespace QInfinity {
@@ -41,22 +49,33 @@ class ManagedDocument;
 
 /**
  * @brief Class for tracking changes to a collaborative document.
- * Its current purpose is to take care of the colorful background highlighting.
+ * It remembers who wrote which part of the text, see userForCursor(), authorForLine()
+ * and authorsInRange(), and takes care of the colorful background highlighting.
+ *
+ * The authorship is kept in an AuthorshipMap only. Highlight ranges are created
+ * from it for the lines around the visible part of each view, so the editor does
+ * not have to move thousands of ranges on each edit in a large document; they are
+ * re-used when the view is scrolled too far, or when the text changes.
  */
 class DocumentChangeTracker : public QObject {
 Q_OBJECT
 public:
     DocumentChangeTracker(ManagedDocument* const document);
 
+    /**
+     * @brief Event filter for tracking the size of the document's views
+     */
+    virtual bool eventFilter(QObject* watched, QEvent* e);
+
 public slots:
     /**
-     * @brief Should be invoked when anyone (you or a remote user) changes the document's text.
+     * @brief Should be invoked for every change to the text, to keep the authorship up to date.
      *
      * @param range The range of the text which was changed
-     * @param user The user who changed the text
+     * @param user The user who changed the text, or 0 if unknown
      * @param removal true if the text was removed, else false
      */
-    void userChangedText(const KTextEditor::Range& range, QInfinity::User* user, bool removal);
+    void textEdited(const KTextEditor::Range& range, QInfinity::User* user, bool removal);
 
     /**
      * @brief Sets up the signals notifying this class about changes to the text after synchronization begins.
@@ -64,7 +83,7 @@ public slots:
     void setupSignals();
 
     /**
-     * @brief Clears all existing highlights.
+     * @brief Clears all existing highlights, and forgets who wrote the text so far.
      */
     void clearHighlight();
 
@@ -81,39 +100,97 @@ public slots:
      */
     QString userForCursor(const KTextEditor::Cursor& position) const;
 
+    /**
+     * @brief Get the user name of the person who wrote most of @p line.
+     *
+     * @return QString readable name of the user, or an empty string if nobody wrote anything in the line
+     */
+    QString authorForLine(int line) const;
+
+    /**
+     * @brief Get the names of all users who wrote text in @p range, in the order of appearance.
+     */
+    QStringList authorsInRange(const KTextEditor::Range& range) const;
+
+    /**
+     * @brief Who wrote which part of the text.
+     */
+    const AuthorshipMap& authorship() const;
+
+    /**
+     * @brief Stores the authorship of the current text in the local cache, see restoreAuthorship().
+     * Should be called while the document is synchronized, before it is closed or resynchronized.
+     */
+    void saveAuthorship() const;
+
+    /**
+     * @brief Loads the authorship stored with saveAuthorship() for this document, and highlights it.
+     *
+     * Nothing happens if the text changed since it was stored.
+     * @return true if the authorship was restored
+     */
+    bool restoreAuthorship();
+
 signals:
     /**
      * @brief Emitted when the used colors change in some way.
      */
     void colorTableChanged();
 
-private:
+private slots:
     /**
-     * @brief Finds empty ranges in m_ranges and deletes them.
+     * @brief Updates the highlight of all views soon.
      */
-    void cleanupRanges();
+    void scheduleUpdate();
+    /**
+     * @brief Creates highlight ranges for the lines around the visible part of each view,
+     * if the existing ones do not cover it, or the text changed.
+     */
+    void updateHighlight();
+    void viewDestroyed(QObject* view);
 
-    void splitRangeForInsertion(KTextEditor::MovingRange* existing, const KTextEditor::Range& splitFor);
+private:
+    /// The highlight ranges of one view
+    struct ViewHighlight {
+        ViewHighlight() : firstLine(-1), lastLine(-1) { };
+        /// The lines the ranges were created for
+        int firstLine;
+        int lastLine;
+        QList<KTextEditor::MovingRange*> ranges;
+    };
 
-    KTextEditor::MovingRange* rangeAt(const KTextEditor::Range& range);
+    /**
+     * @brief Re-uses, creates or deletes the ranges in @p highlight so they cover
+     * the authorship from @p firstLine to @p lastLine.
+     */
+    void highlightLines(KTextEditor::View* view, ViewHighlight& highlight, int firstLine, int lastLine);
 
     /**
-     * @brief Adds a range to the highlighted ranges.
-     *
-     * @param range The raw range to start tracking
-     * @param color The color to use for highlighting
-     * @param bySelf should be true if text was inserted by the local user
-     * @return The range which was created
+     * @brief The attribute used for highlighting text written by @p name.
+     * Also picks a color for @p name, if it doesn't have one yet.
      */
-    KTextEditor::MovingRange* addHighlightedRange(const QString& name, const KTextEditor::Range& range, const QColor& color);
+    KTextEditor::Attribute::Ptr attributeForUser(const QString& name);
+
+    QVector<int> lineLengths() const;
+    /// Where the authorship of this document is stored
+    QString authorshipFile() const;
+    /// Used to check if the stored authorship belongs to the current text
+    QByteArray textHash() const;
 
     ManagedDocument* const m_document;
     KTextEditor::Document* kDocument() const;
     KTextEditor::MovingInterface* m_iface;
     inline KTextEditor::MovingInterface* iface() const { return m_iface; };
-    QList<KTextEditor::MovingRange*> m_ranges;
+    AuthorshipMap m_authorship;
+    /// Whether the background is highlighted, from the configuration
+    bool m_highlight;
+    QHash<QObject*, ViewHighlight> m_viewHighlights;
+    /// Set when the text changed since the views' highlight was updated
+    bool m_textChanged;
+    QTimer m_updateTimer;
     // Maps user names to colors
     QMap<QString, QColor> m_existingColors;
+    QHash<QString, KTextEditor::Attribute::Ptr> m_attributes;
 };
 
 #endif // DOCUMENTCHANGETRACKER_H
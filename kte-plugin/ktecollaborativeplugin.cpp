@@ -23,6 +23,7 @@
 #include "../version.h"
 
 #include "common/connection.h"
+#include "common/credentialstore.h"
 #include "common/document.h"
 #include "common/itemfactory.h"
 #include "common/noteplugin.h"
@@ -33,6 +34,8 @@
 #include <KPluginLoader>
 #include <KLocale>
 #include <KAboutData>
+#include <KConfig>
+#include <KConfigGroup>
 
 #include <KTextEditor/Document>
 #include <KTextEditor/Editor>
@@ -105,11 +108,11 @@ KteCollaborativePlugin::~KteCollaborativePlugin()
 void KteCollaborativePlugin::connectionPrepared(Connection* connection)
 {
     kDebug() << "connection prepared, establishing connection";
-    m_browserModel->addConnection(connection->xmppConnection(), connection->name());
-    foreach ( QInfinity::Browser* browser, m_browserModel->browsers() ) {
-        QObject::connect(browser, SIGNAL(connectionEstablished(const QInfinity::Browser*)),
-                         this, SLOT(browserConnected(const QInfinity::Browser*)), Qt::UniqueConnection);
-    }
+    QInfinity::ConnectionItem* item = m_browserModel->addConnection(connection->xmppConnection(), connection->name());
+    QInfinity::Browser* browser = item->browser();
+    m_browsers.insert(connection, browser);
+    QObject::connect(browser, SIGNAL(connectionEstablished(const QInfinity::Browser*)),
+                     this, SLOT(browserConnected(const QInfinity::Browser*)), Qt::UniqueConnection);
     connection->open();
 }
 
@@ -179,7 +182,7 @@ void KteCollaborativePlugin::checkManageDocument(KTextEditor::Document* document
 
     Connection* connection = ensureConnection(document->url());
 
-    ManagedDocument* managed = new ManagedDocument(document, m_browserModel, m_textPlugin, connection, this);
+    ManagedDocument* managed = new ManagedDocument(document, this, m_textPlugin, connection, this);
     m_managedDocuments[document] = managed;
 
     connect(document, SIGNAL(textInserted(KTextEditor::Document*, KTextEditor::Range)),
@@ -196,6 +199,11 @@ const ManagedDocumentList& KteCollaborativePlugin::managedDocuments() const
     return m_managedDocuments;
 }
 
+QInfinity::Browser* KteCollaborativePlugin::browserForConnection(Connection* connection) const
+{
+    return m_browsers.value(connection);
+}
+
 const QString KteCollaborativePlugin::connectionName(const KUrl& url)
 {
     int port = url.port();
@@ -214,8 +222,12 @@ Connection* KteCollaborativePlugin::ensureConnection(const KUrl& documentUrl)
     QString name = connectionName(documentUrl);
     if ( ! m_connections.contains(name) ) {
         kDebug() << "adding connection" << name << "because it doesn't exist";
+        // Use a password from the URL for this and all further connections to the host
+        Kobby::CredentialStore::instance()->insert(documentUrl);
         Connection* c = new Kobby::Connection(documentUrl.host(), port, name, this);
         c->setProperty("useSimulatedConnection", property("useSimulatedConnection"));
+        KConfig config("ktecollaborative");
+        c->setAutoReconnect(config.group("connection").readEntry("autoReconnect", true));
         connect(c, SIGNAL(ready(Connection*)),
                 this, SLOT(connectionPrepared(Connection*)));
         connect(c, SIGNAL(disconnected(Connection*)),
@@ -233,7 +245,18 @@ Connection* KteCollaborativePlugin::ensureConnection(const KUrl& documentUrl)
 void KteCollaborativePlugin::connectionDisconnected(Connection* connection)
 {
     kDebug() << "disconnected:" << connection;
-    delete m_connections.take(connection->name());
+    if ( connection->willReconnect() ) {
+        foreach ( const ManagedDocument* document, m_managedDocuments ) {
+            if ( document->connection() == connection ) {
+                // The documents will be subscribed again once the connection is back.
+                kDebug() << "keeping connection, it will reconnect";
+                return;
+            }
+        }
+    }
+    m_browsers.remove(connection);
+    // later, so the documents still get the disconnected() signal
+    m_connections.take(connection->name())->deleteLater();
 }
 
 void KteCollaborativePlugin::addView(KTextEditor::View* view)
@@ -41,6 +41,7 @@
 
 #include <QtCore/QObject>
 #include <QStack>
+#include <QPointer>
 
 using namespace Kobby;
 
@@ -99,6 +100,12 @@ public:
      */
     const ManagedDocumentList& managedDocuments() const;
 
+    /**
+     * @brief Get the browser which was created for the given connection.
+     * @return QInfinity::Browser* the browser, or 0 if the connection was not added yet
+     */
+    QInfinity::Browser* browserForConnection(Connection* connection) const;
+
 private:
     /**
      * @brief Ensures that a connection for the given URL exists.
@@ -169,6 +176,8 @@ public slots:
      * @brief Should be invoked when a connection was disconnected.
      * It will delete the connection and remove it from the connection map,
      * such that for new documents a new connetion will be established.
+     * If the connection reconnects automatically and documents still use it,
+     * it is kept instead.
      * @param connection The connection which was disconnected.
      */
     void connectionDisconnected(Connection*);
@@ -199,6 +208,8 @@ private:
     // Maps connection names to connection instances;
     // the connection name is host:port, get it with connectionName(url)
     QHash<QString, Kobby::Connection*> m_connections;
+    // Maps connections to the browser created for them
+    QHash<Kobby::Connection*, QPointer<QInfinity::Browser> > m_browsers;
     // Maps KTextEditor::View instances to KobbyPluginView instances.
     QMap<KTextEditor::View*, KteCollaborativePluginView*> m_views;
 };
@@ -26,7 +26,9 @@
 #include "ui/sharedocumentdialog.h"
 #include "ui/opencollabdocumentdialog.h"
 #include "ui/statusoverlay.h"
+#include "ui/userslistpopup.h"
 #include "documentchangetracker.h"
+#include "usersmodel.h"
 #include "settings/kcm_kte_collaborative.h"
 #include "ktpintegration/inftube.h"
 #include "common/utils.h"
@@ -48,6 +50,7 @@
 #include <QCommandLinkButton>
 #include <QPaintEngine>
 #include <QMenu>
+#include <QSet>
 
 #include <KLocalizedString>
 #include <KActionCollection>
@@ -71,9 +74,11 @@ void setTextColor(QWidget* textWidget, KColorScheme::ForegroundRole colorRole) {
 
 HorizontalUsersList::HorizontalUsersList(KteCollaborativePluginView* view, QWidget* parent, Qt::WindowFlags f)
     : QWidget(parent, f)
-    , m_userTable(0)
+    , m_model(0)
     , m_prefix(new QPushButton(this))
     , m_view(view)
+    , m_summaryOnly(false)
+    , m_isExpanded(false)
     , m_showInactive(true)
     , m_showOffline(false)
 {
@@ -91,7 +96,11 @@ HorizontalUsersList::HorizontalUsersList(KteCollaborativePluginView* view, QWidg
     showInactiveAction->setChecked(m_showInactive);
     menu->addAction(showOfflineAction);
     menu->addAction(showInactiveAction);
+    menu->addSeparator();
+    QAction* listUsersAction = new QAction(KIcon("system-users"), i18n("List all users..."), m_prefix);
+    menu->addAction(listUsersAction);
     m_prefix->setMenu(menu);
+    connect(listUsersAction, SIGNAL(triggered(bool)), this, SLOT(showUsersList()));
 
     connect(showOfflineAction, SIGNAL(triggered(bool)), this, SLOT(showOffline(bool)));
     connect(showInactiveAction, SIGNAL(triggered(bool)), this, SLOT(showIncative(bool)));
@@ -108,15 +117,40 @@ void HorizontalUsersList::showOffline(bool showOffline)
     userTableChanged();
 }
 
+void HorizontalUsersList::showUsersList()
+{
+    if ( ! m_model ) {
+        return;
+    }
+    UsersListPopup* popup = new UsersListPopup(m_model, this);
+    popup->showAbove(m_prefix);
+}
+
 void HorizontalUsersList::showIncative(bool showInactive)
 {
     m_showInactive = showInactive;
     userTableChanged();
 }
 
-void HorizontalUsersList::setUserTable(QInfinity::UserTable* table)
+void HorizontalUsersList::setModel(UsersModel* model)
 {
-    m_userTable = table;
+    if ( model == m_model ) {
+        return;
+    }
+    if ( m_model ) {
+        m_model->disconnect(this);
+    }
+    m_model = model;
+    connect(model, SIGNAL(rowsInserted(QModelIndex,int,int)),
+            this, SLOT(rowsInserted(QModelIndex,int,int)));
+    connect(model, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)),
+            this, SLOT(rowsAboutToBeRemoved(QModelIndex,int,int)));
+    connect(model, SIGNAL(rowsRemoved(QModelIndex,int,int)),
+            this, SLOT(rowsRemoved(QModelIndex,int,int)));
+    connect(model, SIGNAL(dataChanged(QModelIndex,QModelIndex)),
+            this, SLOT(dataChanged(QModelIndex,QModelIndex)));
+    connect(model, SIGNAL(modelReset()), this, SLOT(userTableChanged()));
+    userTableChanged();
 }
 
 void HorizontalUsersList::clear()
@@ -125,67 +159,195 @@ void HorizontalUsersList::clear()
     m_userLabels.clear();
 }
 
-void HorizontalUsersList::addLabelForUser(const QString& name, bool online, const QString& displayName)
+bool HorizontalUsersList::isShown(int row) const
 {
-    if ( name == "Initial document contents" ) return; // TODO urgh
-    const QColor& color = ColorHelper::colorForUsername(name, m_view->kteView(),
-                                                        m_view->document()->changeTracker()->usedColors());
-    UserLabel* label = new UserLabel(displayName, color, online, this);
-    m_userLabels.append(label);
-    if ( online ) {
-        // Sort online users to the front
-        qobject_cast<QBoxLayout*>(layout())->insertWidget(1, label);
+    const QModelIndex index = m_model->index(row);
+    if ( ! m_showOffline && ! index.data(UsersModel::OnlineRole).toBool() ) {
+        return false;
+    }
+    // No color was generated for the user if he did not write any text.
+    return m_showInactive || index.data(UsersModel::ContributedRole).toBool();
+}
+
+bool HorizontalUsersList::updateSummary()
+{
+    int shown = 0;
+    int online = 0;
+    for ( int row = 0; row < m_model->rowCount(); row++ ) {
+        shown += isShown(row) ? 1 : 0;
+        online += m_model->index(row).data(UsersModel::OnlineRole).toBool() ? 1 : 0;
+    }
+    // If more than 20 users would be displayed, just display how many it would be, since there is
+    // no space for more; the whole list is available in the popup (see showUsersList()).
+    const bool summaryOnly = shown > 20;
+    if ( summaryOnly ) {
+        m_prefix->setText(i18nc("tells how many users are online", "%1 users (%2 online)",
+                                m_model->rowCount(), online));
+        clear();
+    }
+    else if ( m_summaryOnly ) {
+        m_prefix->setText(i18n("Users:"));
+        // The labels were removed when switching to the summary, and callers
+        // only update the rows which changed, so recreate all of them.
+        m_summaryOnly = false;
+        for ( int row = 0; row < m_model->rowCount(); row++ ) {
+            updateLabel(row);
+        }
+    }
+    m_summaryOnly = summaryOnly;
+    return ! summaryOnly;
+}
+
+void HorizontalUsersList::updateLabel(int row)
+{
+    const QModelIndex index = m_model->index(row);
+    const QString name = index.data(UsersModel::UserNameRole).toString();
+    UserLabel* label = m_userLabels.value(name);
+    if ( ! isShown(row) ) {
+        if ( label ) {
+            delete m_userLabels.take(name);
+        }
+        return;
+    }
+
+    const bool online = index.data(UsersModel::OnlineRole).toBool();
+    QString displayName(index.data(UsersModel::LocalUserRole).toBool() ? i18nc("%1 is your name", "%1 (you)", name) : name);
+    displayName = online ? displayName : i18nc("%1 is a name", "%1 (offline)", displayName);
+    const QColor color = colorForRow(index);
+    const bool moved = ! label || label->isOnline() != online;
+    if ( label ) {
+        label->setUser(displayName, color, online);
     }
     else {
-        layout()->addWidget(label);
+        label = new UserLabel(displayName, color, online, this);
+        label->setExpanded(m_isExpanded);
+        m_userLabels.insert(name, label);
+    }
+    if ( moved ) {
+        layout()->removeWidget(label);
+        if ( online ) {
+            // Sort online users to the front
+            qobject_cast<QBoxLayout*>(layout())->insertWidget(1, label);
+        }
+        else {
+            layout()->addWidget(label);
+        }
+    }
+}
+
+QColor HorizontalUsersList::colorForRow(const QModelIndex& index)
+{
+    // The model knows the colors of all users who contributed text
+    const QVariant decoration = index.data(Qt::DecorationRole);
+    if ( decoration.isValid() ) {
+        return decoration.value<QColor>();
+    }
+    const QString name = index.data(UsersModel::UserNameRole).toString();
+    QHash<QString, QColor>::const_iterator it = m_inactiveColors.constFind(name);
+    if ( it != m_inactiveColors.constEnd() ) {
+        return it.value();
+    }
+    const QColor color = ColorHelper::colorForUsername(name, m_view->kteView(),
+                                                       m_view->document()->changeTracker()->usedColors());
+    m_inactiveColors.insert(name, color);
+    return color;
+}
+
+void HorizontalUsersList::rowsInserted(const QModelIndex& , int first, int last)
+{
+    if ( ! updateSummary() ) {
+        return;
+    }
+    for ( int row = first; row <= last; row++ ) {
+        updateLabel(row);
     }
+    emit needSizeCheck();
+}
+
+void HorizontalUsersList::rowsAboutToBeRemoved(const QModelIndex& , int first, int last)
+{
+    for ( int row = first; row <= last; row++ ) {
+        delete m_userLabels.take(m_model->index(row).data(UsersModel::UserNameRole).toString());
+    }
+    emit needSizeCheck();
+}
+
+void HorizontalUsersList::rowsRemoved(const QModelIndex& , int , int )
+{
+    // Only now the removed rows are gone from the model
+    updateSummary();
+    emit needSizeCheck();
+}
+
+void HorizontalUsersList::dataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight)
+{
+    // The colors of users without contributions depend on the colors in use
+    m_inactiveColors.clear();
+    if ( ! updateSummary() ) {
+        return;
+    }
+    for ( int row = topLeft.row(); row <= bottomRight.row(); row++ ) {
+        updateLabel(row);
+    }
+    emit needSizeCheck();
 }
 
 UserLabel::UserLabel(const QString& name, const QColor& color, bool online, QWidget* parent)
     : QWidget(parent)
     , box(QSize(12, 12))
+    , m_labelIncrement(0)
+    , m_colorBox(new QLabel())
+    , m_nameLabel(new QLabel())
+    , m_online(online)
 {
     setLayout(new QHBoxLayout);
-    QColor saturated(color);
-    saturated.setHsv(color.hsvHue(), qMin(255, (int) (color.hsvSaturation() * 1.5)), color.value());
-
-    // draw the pixmap with the users' color
-    QLabel* colorBox = new QLabel();
-    QPainter p(&box);
-    p.setBrush(QBrush(saturated));
-    p.setPen(QPen(saturated));
-    p.drawRect(0, 0, 12, 12);
-    // draw a nice shadow
-    p.setPen(QPen(saturated.darker(140)));
-    p.drawRect(0, 0, 11, 11);
-    p.setPen(QPen(saturated.darker(125)));
-    p.drawRect(1, 1, 9, 9);
-    p.setPen(QPen(saturated.darker(110)));
-    p.drawRect(2, 2, 7, 7);
-
-    if ( ! online ) {
-        // If the user is offline, draw an extra shadow mark.
-        QVector<QPoint> points;
-        points << QPoint(0, 12) << QPoint(12, 0) << QPoint(12, 12);
-        p.setPen(QPen(saturated.darker(160)));
-        p.setBrush(QBrush(saturated.darker(160)));
-        p.drawPolygon(points.data(), points.size());
-    }
-
-    colorBox->setPixmap(box);
-    layout()->addWidget(colorBox);
-
-    // remember the size before adding the label
-    const int small = sizeHint().width();
-    m_nameLabel = new QLabel(name);
+    layout()->addWidget(m_colorBox);
     layout()->addWidget(m_nameLabel);
-    // the difference between the old and the new size gives the increment which would
-    // occur if the label was displayed.
-    m_labelIncrement = sizeHint().width() - small;
     // do not display the label initially to avoid flicker
     m_nameLabel->setVisible(false);
+    setUser(name, color, online);
+}
+
+void UserLabel::setUser(const QString& name, const QColor& color, bool online)
+{
+    if ( color != m_color || online != m_online || box.isNull() ) {
+        m_color = color;
+        m_online = online;
+        QColor saturated(color);
+        saturated.setHsv(color.hsvHue(), qMin(255, (int) (color.hsvSaturation() * 1.5)), color.value());
+
+        // draw the pixmap with the users' color
+        box = QPixmap(QSize(12, 12));
+        QPainter p(&box);
+        p.setBrush(QBrush(saturated));
+        p.setPen(QPen(saturated));
+        p.drawRect(0, 0, 12, 12);
+        // draw a nice shadow
+        p.setPen(QPen(saturated.darker(140)));
+        p.drawRect(0, 0, 11, 11);
+        p.setPen(QPen(saturated.darker(125)));
+        p.drawRect(1, 1, 9, 9);
+        p.setPen(QPen(saturated.darker(110)));
+        p.drawRect(2, 2, 7, 7);
+
+        if ( ! online ) {
+            // If the user is offline, draw an extra shadow mark.
+            QVector<QPoint> points;
+            points << QPoint(0, 12) << QPoint(12, 0) << QPoint(12, 12);
+            p.setPen(QPen(saturated.darker(160)));
+            p.setBrush(QBrush(saturated.darker(160)));
+            p.drawPolygon(points.data(), points.size());
+        }
+        p.end();
+        m_colorBox->setPixmap(box);
+    }
 
-    colorBox->setToolTip(name);
+    if ( name != m_nameLabel->text() ) {
+        m_nameLabel->setText(name);
+        m_colorBox->setToolTip(name);
+        // the increment which would occur if the label was displayed
+        m_labelIncrement = m_nameLabel->sizeHint().width() + layout()->spacing();
+    }
 }
 
 void UserLabel::setExpanded(bool expanded)
@@ -195,39 +357,23 @@ void UserLabel::setExpanded(bool expanded)
 
 void HorizontalUsersList::userTableChanged()
 {
-    if ( ! m_userTable || ! m_view->document()->textBuffer()->user() ) {
+    if ( ! m_model || ! m_view->document()->textBuffer() || ! m_view->document()->textBuffer()->user() ) {
         return;
     }
-    clear();
-
-    const QString& ownUserName = m_view->document()->textBuffer()->user()->name();
-    QList< QPointer< QInfinity::User > > users = m_userTable->users();
-    const int activeUsers = m_view->document()->changeTracker()->usedColors().count();
-    foreach ( const QPointer<QInfinity::User>& user, users ) {
-        connect(user.data(), SIGNAL(statusChanged()), this, SLOT(userTableChanged()), Qt::UniqueConnection);
-    }
-
-    if ( ! m_showOffline ) {
-        users = m_userTable->activeUsers();
-    }
-    // If more than 20 users would be displayed, just display how many it would be, for performance
-    // and size reasons.
-    if ( users.length() > 20 && ( m_showInactive || ( ! m_showInactive && activeUsers > 20 ) ) ) {
-        m_prefix->setText(i18nc("tells how many users are online", "%1 users (%2 online)",
-                                m_userTable->users().size(), m_userTable->activeUsers().size()));
+    m_inactiveColors.clear();
+    if ( ! updateSummary() ) {
         return;
     }
-
-    // Otherwise, generate the full table.
-    m_prefix->setText(i18n("Users:"));
-    foreach ( const QPointer<QInfinity::User>& user, users ) {
-        if ( ! m_showInactive && ! m_view->document()->changeTracker()->usedColors().contains(user->name()) ) {
-            // No color was generated for the user; that would have happened if he had wrote text.
-            continue;
+    // Remove labels of users which are gone; all others are updated in place.
+    QSet<QString> names;
+    for ( int row = 0; row < m_model->rowCount(); row++ ) {
+        names << m_model->index(row).data(UsersModel::UserNameRole).toString();
+        updateLabel(row);
+    }
+    foreach ( const QString& name, m_userLabels.keys() ) {
+        if ( ! names.contains(name) ) {
+            delete m_userLabels.take(name);
         }
-        QString label((user->name() == ownUserName) ? i18nc("%1 is your name", "%1 (you)", user->name()) : user->name());
-        label = (user->status() == QInfinity::User::Active) ? label : i18nc("%1 is a name", "%1 (offline)", label);
-        addLabelForUser(user->name(), user->status() == QInfinity::User::Active, label);
     }
     emit needSizeCheck();
 }
@@ -263,8 +409,6 @@ CollaborativeStatusBar::CollaborativeStatusBar(KteCollaborativePluginView* paren
     layout()->addWidget(m_connectionStatusLabel);
     QTimer::singleShot(0, this, SLOT(checkSize()));
     connect(m_usersList, SIGNAL(needSizeCheck()), SLOT(checkSize()));
-    connect(m_view->document()->changeTracker(), SIGNAL(colorTableChanged()),
-            m_usersList, SLOT(userTableChanged()));
 }
 
 bool CollaborativeStatusBar::event(QEvent* e)
@@ -329,8 +473,7 @@ void CollaborativeStatusBar::sessionFullyReady()
 
 void CollaborativeStatusBar::usersChanged()
 {
-    m_usersList->setUserTable(m_view->m_document->userTable());
-    m_usersList->userTableChanged();
+    m_usersList->setModel(m_view->m_document->usersModel());
     checkSize();
 }
 
@@ -491,7 +634,7 @@ void KteCollaborativePluginView::enableUi()
     Document::LoadState loadState = document()->infTextDocument() ? document()->infTextDocument()->loadState()
                                                                   : Kobby::Document::Unloaded;
     if ( loadState != Kobby::Document::Complete ) {
-        m_statusOverlay = new StatusOverlay(m_view);
+        m_statusOverlay = new StatusOverlay(m_view, m_document);
         m_statusOverlay->move(0, 0);
         connect(m_document->connection(), SIGNAL(statusChanged(Connection*,QInfinity::XmlConnection::Status)),
                 m_statusOverlay, SLOT(connectionStatusChanged(Connection*,QInfinity::XmlConnection::Status)));
@@ -683,12 +826,12 @@ void KteCollaborativePluginView::documentReady(ManagedDocument* doc)
     Q_ASSERT(doc == m_document);
     connect(m_document->textBuffer(), SIGNAL(remoteChangedText(KTextEditor::Range,QInfinity::User*,bool)),
             this, SLOT(remoteTextChanged(KTextEditor::Range,QInfinity::User*,bool)));
-    connect(m_document->userTable(), SIGNAL(userAdded(User*)),
-            statusBar(), SLOT(usersChanged()));
-    connect(m_document->userTable(), SIGNAL(userRemoved(User*)),
-            statusBar(), SLOT(usersChanged()));
     m_statusBar->usersChanged();
     statusBar()->sessionFullyReady();
+    KConfig config("ktecollaborative");
+    if ( config.group("notifications").readEntry("displayWidgets", true) ) {
+        RemoteChangeNotifier::showRemoteCarets(m_view, m_document->selectionTracker());
+    }
     m_statusOverlay = 0; // will delete itself
 
     enableActions();
@@ -25,6 +25,7 @@
 #include <QObject>
 #include <QLabel>
 #include <QPushButton>
+#include <QHash>
 #include <KTextEditor/View>
 #include <KUrl>
 
@@ -47,6 +48,8 @@ using Kobby::Document;
 
 class KAction;
 class ManagedDocument;
+class UsersModel;
+class QModelIndex;
 class KteCollaborativePluginView;
 
 /**
@@ -60,6 +63,13 @@ Q_OBJECT
 public:
     UserLabel(const QString& name, const QColor& color, bool online, QWidget* parent);
 
+    /**
+     * @brief Changes the displayed name, color and online state; does nothing if they are the same.
+     */
+    void setUser(const QString& name, const QColor& color, bool online);
+
+    bool isOnline() const { return m_online; };
+
     /**
      * @brief Gives the difference between the collapsed and expanded size (i.e. size of label + margins)
      */
@@ -75,7 +85,10 @@ private:
     QPixmap box;
     /// @see expandedIncrement()
     int m_labelIncrement;
+    QLabel* m_colorBox;
     QLabel* m_nameLabel;
+    QColor m_color;
+    bool m_online;
 };
 
 /**
@@ -83,10 +96,12 @@ private:
  * It has three modes:
  *   - Expanded: User names and colors are displayed next to each other
  *   - Collapsed: Only the colors are displayed, names are provided by tooltips
- *   - "too many users": For >25 users, just displays the amount of users.
+ *   - "too many users": For >20 users, just displays the amount of users; all of them
+ *     can be listed in a popup (UsersListPopup) from the button's menu.
  * The widget will automatically switch to the best of the first two modes, depending on how
  * much size is available. It uses the given view for these calculations. Switching occurs when the
  * widget is resized, or when the user table changes.
+ * The labels follow the document's UsersModel; only the label of a user who changed is updated.
  */
 class HorizontalUsersList : public QWidget {
 Q_OBJECT
@@ -94,9 +109,9 @@ public:
     HorizontalUsersList(KteCollaborativePluginView* view, QWidget* parent = 0, Qt::WindowFlags f = 0);
 
     /**
-     * @brief Provide the user table to the widget. It will not do anything before you call this.
+     * @brief Provide the users model to the widget. It will not do anything before you call this.
      */
-    void setUserTable(QInfinity::UserTable* table);
+    void setModel(UsersModel* model);
 
     /**
      * @brief Remove all user labels from the widget.
@@ -118,30 +133,55 @@ public:
 
 public slots:
     /**
-     * @brief Invoked when the user table changes, i.e. user name change, user joined/left
+     * @brief Brings all labels up to date, e.g. after the filter settings changed
      */
     void userTableChanged();
     /// Handlers for the button menu actions
     void showOffline(bool showOffline);
     void showIncative(bool showInactive);
+    /// Opens a popup listing all users, which works for any number of users
+    void showUsersList();
 
 signals:
     void needSizeCheck();
 
+private slots:
+    void rowsInserted(const QModelIndex& parent, int first, int last);
+    void rowsAboutToBeRemoved(const QModelIndex& parent, int first, int last);
+    void rowsRemoved(const QModelIndex& parent, int first, int last);
+    void dataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight);
+
 private:
     /**
-     * @brief Add a label for the given user to the list.
-     * @param name Name for the user. Color is determined from this.
-     * @param displayName The name which is actually displayed.
+     * @brief Creates, updates or removes the label for the user in @p row, as needed.
+     */
+    void updateLabel(int row);
+    /**
+     * @brief Whether the user in @p row passes the "offline" and "without contributions" filters
+     */
+    bool isShown(int row) const;
+    /**
+     * @brief The color to display for the user at @p index.
+     * Contributors have their color in the model; colors of other users are cached in m_inactiveColors.
+     */
+    QColor colorForRow(const QModelIndex& index);
+    /**
+     * @brief Switches to or from displaying the number of users only, if needed
+     * @return true if single labels should be displayed
      */
-    void addLabelForUser(const QString& name, bool online, const QString& displayName);
+    bool updateSummary();
 
 private:
-    QInfinity::UserTable* m_userTable;
+    UsersModel* m_model;
     /// Text in front of the user list, e.g. "Users:"
     QPushButton* m_prefix;
     KteCollaborativePluginView* m_view;
-    QList<UserLabel*> m_userLabels;
+    /// The displayed labels, by user name
+    QHash<QString, UserLabel*> m_userLabels;
+    /// Colors of users without contributions, until the model changes
+    QHash<QString, QColor> m_inactiveColors;
+    /// Whether only the number of users is displayed
+    bool m_summaryOnly;
     bool m_isExpanded;
     bool m_showInactive;
     bool m_showOffline;
@@ -162,7 +162,8 @@ void ConnectionsWidget::rowClicked(QModelIndex index)
 {
     ConnectionsModel* model = static_cast<ConnectionsModel*>(m_connectionsView->model());
     const QVariantMap& channel = model->m_connections.at(index.row());
-    emit connectionClicked(channel["localEndpoint"].toInt(), channel["nickname"].toString());
+    emit connectionClicked(channel["localEndpoint"].toInt(), channel["nickname"].toString(),
+                           channel["rootDirectory"].toString());
 }
 
 void ConnectionsWidget::setHelpMessage(const QString& message)
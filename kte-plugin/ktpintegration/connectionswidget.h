@@ -75,8 +75,9 @@ signals:
      * The hostname is always "localhost" for the kind of connection listed here.
      * @param localPort the port of the connection
      * @param nickname a suggested nickname to use
+     * @param rootDirectory the directory on the server which belongs to this connection
      */
-    void connectionClicked(unsigned int localPort, QString nickname);
+    void connectionClicked(unsigned int localPort, QString nickname, QString rootDirectory);
 
 private slots:
     void adjustTableSizes();
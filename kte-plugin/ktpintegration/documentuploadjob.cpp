@@ -0,0 +1,124 @@
+/***************************************************************************
+ *   Copyright (C) 2013 by Sven Brauch <svenbrauch@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA .        *
+ ***************************************************************************/
+
+#include "documentuploadjob.h"
+
+#include <KIO/Job>
+#include <KLocalizedString>
+#include <KDebug>
+
+DocumentUploadJob::DocumentUploadJob(QObject* parent)
+    : KJob(parent)
+    , m_finishedBytes(0)
+    , m_finished(0)
+{
+
+}
+
+void DocumentUploadJob::addDocument(const KUrl& source, const KUrl& destination)
+{
+    m_documents << qMakePair(source, destination);
+}
+
+bool DocumentUploadJob::hasDocuments() const
+{
+    return ! m_documents.isEmpty();
+}
+
+void DocumentUploadJob::start()
+{
+    setTotalAmount(KJob::Files, m_documents.size());
+    if ( m_documents.isEmpty() ) {
+        emitResult();
+        return;
+    }
+    typedef QPair<KUrl, KUrl> Document;
+    foreach ( const Document& document, m_documents ) {
+        kDebug() << "uploading" << document.first << "to" << document.second;
+        KIO::FileCopyJob* job = KIO::file_copy(document.first, document.second, -1, KIO::HideProgressInfo);
+        m_amounts.insert(job, qMakePair<qulonglong, qulonglong>(0, 0));
+        connect(job, SIGNAL(result(KJob*)), this, SLOT(copyFinished(KJob*)));
+        connect(job, SIGNAL(totalAmount(KJob*,KJob::Unit,qulonglong)),
+                this, SLOT(copyTotalAmount(KJob*,KJob::Unit,qulonglong)));
+        connect(job, SIGNAL(processedAmount(KJob*,KJob::Unit,qulonglong)),
+                this, SLOT(copyProcessedAmount(KJob*,KJob::Unit,qulonglong)));
+    }
+}
+
+void DocumentUploadJob::copyTotalAmount(KJob* job, KJob::Unit unit, qulonglong amount)
+{
+    if ( unit != KJob::Bytes || ! m_amounts.contains(job) ) {
+        return;
+    }
+    m_amounts[job].first = amount;
+    updateAmounts();
+}
+
+void DocumentUploadJob::copyProcessedAmount(KJob* job, KJob::Unit unit, qulonglong amount)
+{
+    if ( unit != KJob::Bytes || ! m_amounts.contains(job) ) {
+        return;
+    }
+    m_amounts[job].second = amount;
+    updateAmounts();
+}
+
+void DocumentUploadJob::updateAmounts()
+{
+    qulonglong total = m_finishedBytes;
+    qulonglong processed = m_finishedBytes;
+    typedef QPair<qulonglong, qulonglong> Amount;
+    foreach ( const Amount& amount, m_amounts ) {
+        total += amount.first;
+        processed += amount.second;
+    }
+    setTotalAmount(KJob::Bytes, total);
+    setProcessedAmount(KJob::Bytes, processed);
+    emitPercent(processed, total);
+}
+
+void DocumentUploadJob::copyFinished(KJob* job)
+{
+    KIO::FileCopyJob* copyJob = qobject_cast<KIO::FileCopyJob*>(job);
+    Q_ASSERT(copyJob);
+    m_finishedBytes += m_amounts.value(job).first;
+    m_amounts.remove(job);
+    m_finished += 1;
+    setProcessedAmount(KJob::Files, m_finished);
+    updateAmounts();
+
+    if ( copyJob->error() ) {
+        kWarning() << "failed to upload" << copyJob->srcUrl() << copyJob->errorString();
+        m_errors << copyJob->errorString();
+        emit documentFailed(copyJob->destUrl(), copyJob->errorString());
+    }
+    else {
+        emit documentUploaded(copyJob->destUrl());
+    }
+
+    if ( m_amounts.isEmpty() ) {
+        if ( ! m_errors.isEmpty() ) {
+            setError(KJob::UserDefinedError);
+            setErrorText(m_errors.join("\n"));
+        }
+        emitResult();
+    }
+}
+
+#include "documentuploadjob.moc"
@@ -0,0 +1,83 @@
+/***************************************************************************
+ *   Copyright (C) 2013 by Sven Brauch <svenbrauch@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA .        *
+ ***************************************************************************/
+
+#ifndef DOCUMENTUPLOADJOB_H
+#define DOCUMENTUPLOADJOB_H
+
+#include <KJob>
+#include <KUrl>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QStringList>
+
+#include "inftube_export.h"
+
+/**
+ * @brief Uploads a set of documents to an infinote server, all at the same time.
+ * Progress is reported through the usual KJob amounts (bytes and files).
+ * The job finishes when all documents are either uploaded or failed; it has an
+ * error if at least one document failed.
+ */
+class INFTUBE_EXPORT DocumentUploadJob : public KJob {
+Q_OBJECT
+public:
+    explicit DocumentUploadJob(QObject* parent = 0);
+
+    /**
+     * @brief Add a document to upload. Must be called before start().
+     * @param source where to read the document from, e.g. a local file
+     * @param destination the inf:// URL to create the document at
+     */
+    void addDocument(const KUrl& source, const KUrl& destination);
+
+    /**
+     * @brief Whether any documents were added.
+     */
+    bool hasDocuments() const;
+
+    virtual void start();
+
+signals:
+    /**
+     * @brief Emitted as soon as a single document is available on the server.
+     */
+    void documentUploaded(const KUrl& destination);
+    /**
+     * @brief Emitted if a single document could not be uploaded.
+     */
+    void documentFailed(const KUrl& destination, const QString& errorString);
+
+private slots:
+    void copyFinished(KJob* job);
+    void copyTotalAmount(KJob* job, KJob::Unit unit, qulonglong amount);
+    void copyProcessedAmount(KJob* job, KJob::Unit unit, qulonglong amount);
+
+private:
+    void updateAmounts();
+
+    QList< QPair<KUrl, KUrl> > m_documents;
+    /// Total and processed bytes for each running copy job
+    QHash<KJob*, QPair<qulonglong, qulonglong> > m_amounts;
+    qulonglong m_finishedBytes;
+    int m_finished;
+    QStringList m_errors;
+};
+
+#endif
@@ -0,0 +1,220 @@
+/***************************************************************************
+ *   Copyright (C) 2013 by Sven Brauch <svenbrauch@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA .        *
+ ***************************************************************************/
+
+#include "infinotedprocess.h"
+
+#include "infinoted.h"
+#include "common/utils.h"
+
+#include <KDebug>
+
+#include <QDir>
+#include <QTcpServer>
+
+// How often a server is started on a different port before giving up
+static const int maxStartAttempts = 5;
+// How long infinoted may take to accept connections after being started, in ms
+static const int startupTimeout = 3000;
+// Interval between two connection attempts while waiting for infinoted, in ms
+static const int probeInterval = 20;
+// How long infinoted may take to exit after being asked to in stop(), in ms
+static const int stopTimeout = 5000;
+
+InfinotedProcess::InfinotedProcess(QObject* parent)
+    : QObject(parent)
+    , m_process(0)
+    , m_probe(new QTcpSocket(this))
+    , m_port(0)
+    , m_attemptsLeft(maxStartAttempts)
+    , m_ready(false)
+{
+    m_probeTimer.setSingleShot(true);
+    m_probeTimer.setInterval(probeInterval);
+    connect(&m_probeTimer, SIGNAL(timeout()), this, SLOT(probe()));
+    connect(m_probe, SIGNAL(connected()), this, SLOT(probeConnected()));
+    connect(m_probe, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(probeFailed()));
+}
+
+InfinotedProcess::~InfinotedProcess()
+{
+    if ( m_process ) {
+        m_process->disconnect(this);
+        delete m_process;
+    }
+}
+
+unsigned short InfinotedProcess::port() const
+{
+    return m_port;
+}
+
+bool InfinotedProcess::isReady() const
+{
+    return m_ready;
+}
+
+QString InfinotedProcess::rootDirectory() const
+{
+    return serverDirectory(m_port);
+}
+
+QString InfinotedProcess::serverDirectory(unsigned short port)
+{
+    return QDir::tempPath() + "/infinote-" + getUserName() + "/server-" + QString::number(port);
+}
+
+void InfinotedProcess::start()
+{
+    if ( ! reservePort() ) {
+        kWarning() << "could not find a free port for infinoted";
+        emit failed(this);
+        return;
+    }
+    launch();
+}
+
+void InfinotedProcess::stop()
+{
+    m_probeTimer.stop();
+    m_probe->abort();
+    m_ready = false;
+    if ( ! m_process ) {
+        return;
+    }
+    // Deleting a running QProcess blocks until it has exited, so detach it
+    // and let it clean up after itself once infinoted is gone.
+    QProcess* process = m_process;
+    m_process = 0;
+    process->disconnect(this);
+    process->setParent(0);
+    if ( process->state() == QProcess::NotRunning ) {
+        process->deleteLater();
+        return;
+    }
+    connect(process, SIGNAL(finished(int,QProcess::ExitStatus)), process, SLOT(deleteLater()));
+    QTimer::singleShot(stopTimeout, process, SLOT(kill()));
+    process->terminate();
+}
+
+bool InfinotedProcess::reservePort()
+{
+    // Binding to port 0 makes the system choose a port which is free right now.
+    // There's a small window until infinoted binds it, but if someone else takes
+    // it in the meantime, infinoted exits and we simply try another one.
+    QTcpServer server;
+    if ( ! server.listen(QHostAddress::LocalHost, 0) ) {
+        return false;
+    }
+    m_port = server.serverPort();
+    server.close();
+    return m_port != 0;
+}
+
+void InfinotedProcess::launch()
+{
+    m_attemptsLeft -= 1;
+    kDebug() << "starting infinoted on port" << m_port;
+    // Ensure the server directory actually exists
+    QDir d(rootDirectory());
+    if ( ! d.exists() ) {
+        d.mkpath(d.path());
+    }
+    m_process = new QProcess(this);
+    m_process->setEnvironment(QStringList() << "LIBINFINITY_DEBUG_PRINT_TRAFFIC=1");
+    m_process->setStandardOutputFile(rootDirectory() + "/infinoted.log");
+    m_process->setStandardErrorFile(rootDirectory() + "/infinoted.errors");
+    connect(m_process, SIGNAL(error(QProcess::ProcessError)), this, SLOT(processError(QProcess::ProcessError)));
+    connect(m_process, SIGNAL(finished(int,QProcess::ExitStatus)), this, SLOT(processFinished()));
+    m_process->start(QString(INFINOTED_PATH), QStringList() << "--security-policy=no-tls"
+                                              << "-r" << rootDirectory() << "-p" << QString::number(m_port));
+    m_startTime.start();
+    m_probeTimer.start();
+}
+
+void InfinotedProcess::probe()
+{
+    if ( ! m_process || m_process->state() == QProcess::NotRunning ) {
+        return;
+    }
+    m_probe->abort();
+    m_probe->connectToHost(QHostAddress(QHostAddress::LocalHost), m_port);
+}
+
+void InfinotedProcess::probeConnected()
+{
+    m_probe->abort();
+    m_ready = true;
+    kDebug() << "successfully started infinoted on port" << m_port << "( root dir" << rootDirectory() << ")"
+             << "after" << m_startTime.elapsed() << "ms";
+    emit ready(this);
+}
+
+void InfinotedProcess::probeFailed()
+{
+    if ( m_ready ) {
+        return;
+    }
+    if ( m_startTime.elapsed() > startupTimeout ) {
+        kDebug() << "infinoted did not start accepting connections on port" << m_port;
+        retry();
+        return;
+    }
+    m_probeTimer.start();
+}
+
+void InfinotedProcess::processError(QProcess::ProcessError error)
+{
+    if ( error == QProcess::FailedToStart ) {
+        // No point in trying other ports if the executable can't be run at all
+        kWarning() << "failed to run" << INFINOTED_PATH;
+        m_probeTimer.stop();
+        emit failed(this);
+    }
+}
+
+void InfinotedProcess::processFinished()
+{
+    if ( m_ready ) {
+        kDebug() << "infinoted on port" << m_port << "exited";
+        m_ready = false;
+        emit died(this);
+        return;
+    }
+    kDebug() << "infinoted exited during startup on port" << m_port;
+    retry();
+}
+
+void InfinotedProcess::retry()
+{
+    m_probeTimer.stop();
+    m_probe->abort();
+    if ( m_process ) {
+        m_process->disconnect(this);
+        m_process->kill();
+        m_process->deleteLater();
+        m_process = 0;
+    }
+    if ( m_attemptsLeft <= 0 || ! reservePort() ) {
+        emit failed(this);
+        return;
+    }
+    launch();
+}
+
+#include "infinotedprocess.moc"
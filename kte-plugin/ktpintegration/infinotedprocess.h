@@ -0,0 +1,117 @@
+/***************************************************************************
+ *   Copyright (C) 2013 by Sven Brauch <svenbrauch@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA .        *
+ ***************************************************************************/
+
+#ifndef INFINOTEDPROCESS_H
+#define INFINOTEDPROCESS_H
+
+#include <QObject>
+#include <QProcess>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QTime>
+
+#include "inftube_export.h"
+
+/**
+ * @brief Starts an infinoted instance on a free local port without blocking.
+ * Call start(), then wait for either ready() or failed() to be emitted.
+ * The server process is terminated when this object is destroyed.
+ */
+class INFTUBE_EXPORT InfinotedProcess : public QObject {
+Q_OBJECT
+public:
+    explicit InfinotedProcess(QObject* parent = 0);
+    virtual ~InfinotedProcess();
+
+    /**
+     * @brief Reserve a port and launch the server. Returns immediately.
+     */
+    void start();
+
+    /**
+     * @brief Ask the server to exit without waiting for it. Returns immediately.
+     * The process is killed if it does not exit in time; this object may be deleted right away.
+     */
+    void stop();
+
+    /**
+     * @brief The port the server listens on. Only valid after ready() was emitted.
+     */
+    unsigned short port() const;
+
+    /**
+     * @brief Whether the server is up and accepting connections.
+     */
+    bool isReady() const;
+
+    /**
+     * @brief The directory the server stores its documents and log files in.
+     */
+    QString rootDirectory() const;
+
+    /**
+     * @brief The directory used for a server running on the given port.
+     */
+    static QString serverDirectory(unsigned short port);
+
+signals:
+    /**
+     * @brief Emitted once the server accepts connections.
+     */
+    void ready(InfinotedProcess* self);
+    /**
+     * @brief Emitted if the server could not be started at all.
+     */
+    void failed(InfinotedProcess* self);
+    /**
+     * @brief Emitted if the server exits after it was ready.
+     */
+    void died(InfinotedProcess* self);
+
+private slots:
+    void probe();
+    void probeConnected();
+    void probeFailed();
+    void processError(QProcess::ProcessError error);
+    void processFinished();
+
+private:
+    /**
+     * @brief Let the system pick a free port on the local interface.
+     */
+    bool reservePort();
+    /**
+     * @brief Start the process on m_port and begin probing it.
+     */
+    void launch();
+    /**
+     * @brief Give up on the current process and try again on a different port, if attempts are left.
+     */
+    void retry();
+
+    QProcess* m_process;
+    QTcpSocket* m_probe;
+    QTimer m_probeTimer;
+    QTime m_startTime;
+    unsigned short m_port;
+    int m_attemptsLeft;
+    bool m_ready;
+};
+
+#endif
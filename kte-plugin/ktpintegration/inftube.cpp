@@ -19,7 +19,8 @@
 
 #include "inftube.h"
 
-#include "infinoted.h"
+#include "infinotedprocess.h"
+#include "documentuploadjob.h"
 #include "common/selecteditorwidget.h"
 #include "common/utils.h"
 
@@ -38,16 +39,18 @@
 #include <TelepathyQt/ChannelClassSpecList>
 #include <TelepathyQt/ContactManager>
 #include <KIO/Job>
+#include <KIO/JobUiDelegate>
+#include <KJobTrackerInterface>
 #include <KRun>
 #include <KDebug>
 #include <KMessageBox>
 #include <KLocalizedString>
 #include <KStandardDirs>
+#include <KConfig>
+#include <KConfigGroup>
 #include <krun.h>
 
-#include <QTcpServer>
-#include <QTcpSocket>
-#include <unistd.h>
+#include <QDir>
 #include <kdirnotify.h>
 
 QDBusArgument &operator<<(QDBusArgument &argument, const ChannelList& message) {
@@ -109,6 +112,7 @@ ChannelList InfTubeConnectionMonitor::getChannels()
         result["localEndpoint"] = channel->ipAddress().second;
         result["nickname"] = nickname;
         result["accountPath"] = channel->property("accountPath");
+        result["rootDirectory"] = channel->parameters().value("rootDirectory", QLatin1String("/"));
         channels << result;
     }
     return channels;
@@ -149,6 +153,7 @@ const QString serviceName()
 InfTubeBase::InfTubeBase(QObject* parent)
     : QObject(parent)
     , m_port(-1)
+    , m_rootDirectory(QLatin1String("/"))
 {
 
 }
@@ -172,6 +177,25 @@ KUrl InfTubeBase::localUrl() const
     return url;
 }
 
+const QString& InfTubeBase::rootDirectory() const
+{
+    return m_rootDirectory;
+}
+
+void InfTubeBase::setRootDirectoryFromParameters(const QVariantMap& parameters)
+{
+    m_rootDirectory = parameters.value("rootDirectory", QLatin1String("/")).toString();
+}
+
+QString InfTubeBase::tubePath(const QString& rootDirectory, const QString& path)
+{
+    QString result = rootDirectory.isEmpty() ? QString(QLatin1String("/")) : rootDirectory;
+    if ( ! result.endsWith('/') ) {
+        result.append('/');
+    }
+    return result + ( path.startsWith('/') ? path.mid(1) : path );
+}
+
 const QString& InfTubeBase::nickname() const
 {
     return m_nickname;
@@ -191,17 +215,18 @@ InfTubeRequester::InfTubeRequester(QObject* parent)
 
 }
 
-void InfTubeRequester::jobFinished(KJob* job)
+void InfTubeRequester::documentUploaded(const KUrl& url)
 {
-    KIO::FileCopyJob* j = qobject_cast<KIO::FileCopyJob*>(job);
-    Q_ASSERT(j);
-    if ( j->error() ) {
-        KMessageBox::error(0, i18n("Failed to share file: %1", j->errorString()));
-        return;
+    KUrl documentUrl(url);
+    documentUrl.setUser(nickname());
+    emit collaborativeDocumentReady(documentUrl);
+}
+
+void InfTubeRequester::uploadFinished(KJob* job)
+{
+    if ( job->error() ) {
+        KMessageBox::error(0, i18n("Failed to share file: %1", job->errorString()));
     }
-    KUrl url = j->destUrl();
-    url.setUser(nickname());
-    emit collaborativeDocumentReady(url);
 }
 
 void InfTubeRequester::onTubeRequestReady(Tp::PendingOperation* operation)
@@ -234,14 +259,19 @@ void InfTubeRequester::onTubeReady(Tp::PendingOperation* operation)
     bool ok = false;
     m_port = channel->parameters()["localSocket"].toUInt(&ok);
     Q_ASSERT(ok);
+    setRootDirectoryFromParameters(channel->parameters());
 
-    // add the initial documents
+    // add the initial documents; each one is opened as soon as it is on the server
+    DocumentUploadJob* upload = new DocumentUploadJob(this);
     foreach ( const KUrl& document, m_shareDocuments ) {
         KUrl x = localUrl();
-        x.setFileName(document.fileName());
-        KIO::FileCopyJob* job = KIO::file_copy(document, x, -1, KIO::HideProgressInfo);
-        connect(job, SIGNAL(finished(KJob*)), this, SLOT(jobFinished(KJob*)));
+        x.setPath(tubePath(m_rootDirectory, document.fileName()));
+        upload->addDocument(document, x);
     }
+    connect(upload, SIGNAL(documentUploaded(KUrl)), this, SLOT(documentUploaded(KUrl)));
+    connect(upload, SIGNAL(result(KJob*)), this, SLOT(uploadFinished(KJob*)));
+    KIO::getJobTracker()->registerJob(upload);
+    upload->start();
 }
 
 Tp::PendingChannelRequest* InfTubeRequester::offer(const Tp::AccountPtr& account, const Tp::ContactPtr& contact, const DocumentList& documents)
@@ -272,6 +302,7 @@ InfTubeServer::InfTubeServer(QObject* parent)
     : InfTubeBase(parent)
     , m_tubeServer(0)
     , m_hasCreatedChannel(false)
+    , m_tubeCount(0)
 {
 
 }
@@ -289,6 +320,8 @@ void InfTubeServer::registerHandler()
             this, SLOT(tubeRequested(Tp::AccountPtr,Tp::OutgoingStreamTubeChannelPtr,QDateTime,Tp::ChannelRequestHints)));
     connect(m_tubeServer.data(), SIGNAL(tubeClosed(Tp::AccountPtr,Tp::OutgoingStreamTubeChannelPtr,QString,QString)),
             this, SLOT(tubeClosed(Tp::AccountPtr,Tp::OutgoingStreamTubeChannelPtr,QString,QString)));
+    // Have a server ready for the next tube which is requested
+    ServerManager::instance()->replenish();
 }
 
 void InfTubeServer::tubeClosed(Tp::AccountPtr , Tp::OutgoingStreamTubeChannelPtr channel, QString , QString )
@@ -328,107 +361,221 @@ void InfTubeServer::tubeRequested(Tp::AccountPtr account, Tp::OutgoingStreamTube
     connect(channel->targetContact().data(), SIGNAL(presenceChanged(Tp::Presence)),
             this, SLOT(targetPresenceChanged(Tp::Presence)));
 
-    // set infinoted's socket as the local endpoint of the tube
-    unsigned short port = -1;
-    bool success = startInfinoted(&port);
-    if ( ! success ) {
-        KMessageBox::detailedError(0, i18n("Failed to start collaborative server, the session could not be initiated."),
-                                   i18nc("%1: directory", "Look at the log files in %1 for more information.", serverDirectory(port)));
-        channel->requestClose();
+    // set infinoted's socket as the local endpoint of the tube, once it is running
+    PendingTube tube;
+    tube.account = account;
+    tube.channel = channel;
+    tube.hints = requestHints.allHints();
+    tube.sharedServer = false;
+    tube.port = 0;
+
+    ServerManager* manager = ServerManager::instance();
+    if ( manager->useSharedServer() ) {
+        tube.sharedServer = true;
+        InfinotedProcess* server = manager->sharedServer();
+        if ( server->isReady() ) {
+            createTubeDirectory(tube, server->port());
+            return;
+        }
+        if ( ! m_pendingTubes.contains(server) ) {
+            connect(server, SIGNAL(ready(InfinotedProcess*)), this, SLOT(serverReady(InfinotedProcess*)));
+            connect(server, SIGNAL(failed(InfinotedProcess*)), this, SLOT(serverFailed(InfinotedProcess*)));
+        }
+        m_pendingTubes.insert(server, tube);
         return;
     }
 
-    QVariantMap hints;
-    hints = hints.unite(requestHints.allHints());
-    hints.insert("localSocket", QString::number(port));
+    InfinotedProcess* server = manager->takeServer();
+    // Start a replacement for the server just taken (or for the next request)
+    manager->replenish();
+    if ( server && ! channel->isValid() ) {
+        kDebug() << "channel went away before the server could be used";
+        manager->returnServer(server);
+        return;
+    }
+    if ( server ) {
+        kDebug() << "using pre-started server on port" << server->port();
+        server->setParent(this);
+        m_serverProcesses << server;
+        exportTube(tube, server->port(), QLatin1String("/"));
+        return;
+    }
 
-    KUrl localUrl;
-    localUrl.setProtocol("inf");
-    localUrl.setHost("127.0.0.1");
-    localUrl.setUser(account->displayName());
-    localUrl.setPort(port);
+    server = new InfinotedProcess(this);
+    m_serverProcesses << server;
+    m_pendingTubes.insert(server, tube);
+    connect(server, SIGNAL(ready(InfinotedProcess*)), this, SLOT(serverReady(InfinotedProcess*)));
+    connect(server, SIGNAL(failed(InfinotedProcess*)), this, SLOT(serverFailed(InfinotedProcess*)));
+    server->start();
+}
+
+void InfTubeServer::serverFailed(InfinotedProcess* server)
+{
+    const QList<PendingTube> tubes = m_pendingTubes.values(server);
+    m_pendingTubes.remove(server);
+    server->disconnect(this);
+    KMessageBox::detailedError(0, i18n("Failed to start collaborative server, the session could not be initiated."),
+                               i18nc("%1: directory", "Look at the log files in %1 for more information.", server->rootDirectory()));
+    foreach ( const PendingTube& tube, tubes ) {
+        if ( ! tube.channel.isNull() ) {
+            tube.channel->requestClose();
+        }
+    }
+    // The shared server belongs to the ServerManager
+    if ( m_serverProcesses.removeAll(server) ) {
+        server->deleteLater();
+    }
+}
+
+void InfTubeServer::serverReady(InfinotedProcess* server)
+{
+    const QList<PendingTube> tubes = m_pendingTubes.values(server);
+    m_pendingTubes.remove(server);
+    server->disconnect(this);
+    bool exported = false;
+    foreach ( const PendingTube& tube, tubes ) {
+        if ( ! tube.channel->isValid() ) {
+            kDebug() << "channel went away while the server was starting";
+            continue;
+        }
+        if ( tube.sharedServer ) {
+            createTubeDirectory(tube, server->port());
+        }
+        else {
+            exportTube(tube, server->port(), QLatin1String("/"));
+        }
+        exported = true;
+    }
+    // Nobody is going to use this server; the shared server belongs to the ServerManager
+    if ( ! exported && m_serverProcesses.removeAll(server) ) {
+        ServerManager::instance()->returnServer(server);
+    }
+}
+
+void InfTubeServer::createTubeDirectory(const PendingTube& tube, unsigned short port)
+{
+    PendingTube creating = tube;
+    creating.port = port;
+    // Skip the names of directories left over from earlier sessions on this server
+    do {
+        m_tubeCount += 1;
+        creating.rootDirectory = "/tube-" + QString::number(m_tubeCount);
+    } while ( QDir(InfinotedProcess::serverDirectory(port) + creating.rootDirectory).exists() );
+
+    // infinoted does not notice directories created on disk once it explored their
+    // parent, so the directory must be created through the server itself.
+    KUrl url;
+    url.setProtocol("inf");
+    url.setHost("127.0.0.1");
+    url.setPort(port);
+    url.setPath(creating.rootDirectory);
+    KIO::SimpleJob* job = KIO::mkdir(url);
+    m_creatingDirectories.insert(job, creating);
+    connect(job, SIGNAL(result(KJob*)), this, SLOT(tubeDirectoryCreated(KJob*)));
+}
+
+void InfTubeServer::tubeDirectoryCreated(KJob* job)
+{
+    const PendingTube tube = m_creatingDirectories.take(job);
+    if ( ! tube.channel->isValid() ) {
+        kDebug() << "channel went away while creating its directory";
+        return;
+    }
+    if ( job->error() ) {
+        KMessageBox::error(0, i18n("Failed to prepare the collaborative server, the session could not be initiated: %1",
+                                   job->errorString()));
+        tube.channel->requestClose();
+        return;
+    }
+    exportTube(tube, tube.port, tube.rootDirectory);
+}
+
+void InfTubeServer::exportTube(const PendingTube& tube, unsigned short port, const QString& rootDirectory)
+{
+    PendingTube exported = tube;
+    exported.port = port;
+    exported.rootDirectory = rootDirectory;
+
+    const QVariantMap& hints = tube.hints;
     if ( hints.contains("needToOpenDocument") && hints["needToOpenDocument"].toBool() == true ) {
         // For tubes requested from e.g. ktp-contact-list, the server side
-        // also needs to open the document.
+        // also needs to upload the documents. Do that before the tube is
+        // published, so the documents are already there when the other side
+        // and the local editor look for them.
         bool ok = false;
         QVector<KUrl> sources;
         QVector<QString> paths = documentsListFromParameters(hints, &ok, &sources);
-        // TODO error handling
+        KUrl localUrl;
+        localUrl.setProtocol("inf");
+        localUrl.setHost("127.0.0.1");
+        localUrl.setPort(port);
+        DocumentUploadJob* upload = new DocumentUploadJob(this);
         for ( int i = 0; i < sources.size(); i++ ) {
-            const QString path = paths.at(i);
-            localUrl.setPath(path);
             const KUrl source = sources.at(i);
             if ( source.isValid() ) {
-                // TODO waiting?
-                kDebug() << "copying file" << source;
-                KIO::file_copy(source, localUrl, KIO::HideProgressInfo);
+                localUrl.setPath(tubePath(rootDirectory, paths.at(i)));
+                upload->addDocument(source, localUrl);
             }
         }
+        if ( upload->hasDocuments() ) {
+            m_uploadingTubes.insert(upload, exported);
+            connect(upload, SIGNAL(result(KJob*)), this, SLOT(uploadFinished(KJob*)));
+            KIO::getJobTracker()->registerJob(upload);
+            upload->start();
+            return;
+        }
+        delete upload;
+    }
+    publishTube(exported);
+}
+
+void InfTubeServer::uploadFinished(KJob* job)
+{
+    const PendingTube tube = m_uploadingTubes.take(job);
+    if ( job->error() ) {
+        KMessageBox::error(0, i18n("Failed to share file: %1", job->errorString()));
+    }
+    if ( ! tube.channel->isValid() ) {
+        kDebug() << "channel went away while uploading documents";
+        return;
+    }
+    publishTube(tube);
+}
+
+void InfTubeServer::publishTube(const PendingTube& tube)
+{
+    QVariantMap hints = tube.hints;
+    hints.insert("localSocket", QString::number(tube.port));
+    hints.insert("rootDirectory", tube.rootDirectory);
+
+    KUrl localUrl;
+    localUrl.setProtocol("inf");
+    localUrl.setHost("127.0.0.1");
+    localUrl.setUser(tube.account->displayName());
+    localUrl.setPort(tube.port);
+    if ( hints.contains("needToOpenDocument") && hints["needToOpenDocument"].toBool() == true ) {
+        bool ok = false;
+        QVector<QString> paths = documentsListFromParameters(hints, &ok);
         foreach ( const QString& path, paths ) {
-            localUrl.setPath(path);
+            localUrl.setPath(tubePath(tube.rootDirectory, path));
             tryOpenDocumentWithDialog(localUrl);
         }
     }
 
-    m_tubeServer->exportTcpSocket(QHostAddress(QHostAddress::LocalHost), port, hints);
+    m_tubeServer->exportTcpSocket(QHostAddress(QHostAddress::LocalHost), tube.port, hints);
 
-    channel->setProperty("accountPath", account->objectPath());
-    m_channels.append(channel);
+    tube.channel->setProperty("accountPath", tube.account->objectPath());
+    m_channels.append(tube.channel);
 
     ensureNotifierModuleLoaded();
-    localUrl.setPath("/");
+    localUrl.setPath(tube.rootDirectory);
     kDebug() << "emitting entered URL" << localUrl;
     OrgKdeKDirNotifyInterface::emitEnteredDirectory(localUrl.url());
 }
 
 QString InfTubeServer::serverDirectory(unsigned short port) const
 {
-    return QDir::tempPath() + "/infinote-" + getUserName() + "/server-" + QString::number(port);
-}
-
-bool InfTubeServer::startInfinoted(unsigned short* port)
-{
-    *port = 49152 + (QTime::currentTime().msec() + QTime::currentTime().second() * 1000) % (65535-49152);
-    bool running = false;
-    int retriesLeft = 15;
-    while ( ! running && retriesLeft >= 0 ) {
-        retriesLeft -= 1;
-        // Try next port
-        *port = *port >= 65535 ? 49152 : *port + 1;
-        kDebug() << "trying port" << *port;
-        // Ensure the server directory actually exists
-        QDir d(serverDirectory(*port));
-        if ( ! d.exists() ) {
-            d.mkpath(d.path());
-        }
-        QProcess* serverProcess = new QProcess;
-        m_serverProcesses << serverProcess;
-        serverProcess->setEnvironment(QStringList() << "LIBINFINITY_DEBUG_PRINT_TRAFFIC=1");
-        serverProcess->setStandardOutputFile(serverDirectory(*port) + "/infinoted.log");
-        serverProcess->setStandardErrorFile(serverDirectory(*port) + "/infinoted.errors");
-        serverProcess->start(QString(INFINOTED_PATH), QStringList() << "--security-policy=no-tls"
-                                            << "-r" << serverDirectory(*port) << "-p" << QString::number(*port));
-        serverProcess->waitForStarted(500);
-        int timeout = 30; // 30 retries at 100 ms -> 3s
-        for ( int i = 0; i < timeout; i ++ ) {
-            if ( serverProcess->state() != QProcess::Running ) {
-                kDebug() << "server did not start";
-                break;
-            }
-            QTcpSocket s;
-            s.connectToHost("127.0.0.1", *port);
-            if ( s.waitForConnected(50) ) {
-                running = true;
-                kDebug() << "successfully started infinioted on port" << *port
-                         << "( root dir" << serverDirectory(*port) << ")";
-                break;
-            }
-            usleep(50000);
-        }
-        kDebug() << "failed, trying next port";
-    }
-    usleep(200000);
-    return running;
+    return InfinotedProcess::serverDirectory(port);
 }
 
 InfTubeServer::~InfTubeServer()
@@ -508,7 +655,9 @@ void InfTubeClient::tubeAcceptedAsTcp(QHostAddress /*address*/, quint16 port, QH
     kDebug() << "parameters:" << tube->parameters();
     // TODO error handling
     m_port = port;
+    setRootDirectoryFromParameters(tube->parameters());
     KUrl url = localUrl();
+    url.setPath(m_rootDirectory);
     setNicknameFromAccount(account);
     url.setUser(nickname());
 
@@ -523,7 +672,7 @@ void InfTubeClient::tubeAcceptedAsTcp(QHostAddress /*address*/, quint16 port, QH
     }
     else {
         foreach ( const QString& path, paths ) {
-            url.setPath(path);
+            url.setPath(tubePath(m_rootDirectory, path));
             // Retry until the user selects a working application, or aborts
             tryOpenDocumentWithDialog(url);
         }
@@ -535,7 +684,7 @@ void InfTubeClient::tubeAcceptedAsTcp(QHostAddress /*address*/, quint16 port, QH
 
     // Notify that we should now watch this directory, for when files are added later on
     ensureNotifierModuleLoaded();
-    url.setPath("/");
+    url.setPath(m_rootDirectory);
     kDebug() << "emitting entered URL" << url;
     OrgKdeKDirNotifyInterface::emitEnteredDirectory(url.url());
 }
@@ -583,10 +732,27 @@ Tp::AccountManagerPtr getAccountManager()
                                       contactFactory);
 }
 
-ServerManager::ServerManager(QObject* parent): QObject(parent)
+ServerManager::ServerManager(QObject* parent)
+    : QObject(parent)
 {
     accountManager = getAccountManager();
 
+    KConfig config("ktecollaborative");
+    KConfigGroup group = config.group("server");
+    m_poolSize = qMax(0, group.readEntry("poolSize", 1));
+    m_idleTimeout = group.readEntry("idleTimeout", 600) * 1000;
+#ifdef ENABLE_SHARED_SERVER
+    m_useSharedServer = group.readEntry("sharedServer", false);
+#else
+    // infinoted 0.6 has no per-directory ACLs, so every contact on a shared server could
+    // browse and open the documents of all other tubes. Not available until tubes are isolated.
+    m_useSharedServer = false;
+#endif
+    m_sharedServer = 0;
+
+    m_reapTimer.setInterval(30000);
+    connect(&m_reapTimer, SIGNAL(timeout()), this, SLOT(reapIdleServers()));
+
     connect(QApplication::instance(), SIGNAL(aboutToQuit()), this, SLOT(shutdown()));
     connect(QApplication::instance(), SIGNAL(aboutToQuit()), this, SLOT(deleteLater()));
 }
@@ -607,10 +773,129 @@ void ServerManager::add(InfTubeServer* server)
     m_serverProcesses.append(server);
 }
 
+InfinotedProcess* ServerManager::takeServer()
+{
+    if ( m_idleServers.isEmpty() ) {
+        return 0;
+    }
+    InfinotedProcess* server = m_idleServers.takeFirst();
+    m_idleSince.remove(server);
+    server->disconnect(this);
+    if ( m_idleServers.isEmpty() ) {
+        m_reapTimer.stop();
+    }
+    return server;
+}
+
+void ServerManager::returnServer(InfinotedProcess* server)
+{
+    server->disconnect(this);
+    server->setParent(this);
+    if ( m_useSharedServer || ! server->isReady()
+         || m_idleServers.size() + m_startingServers.size() >= m_poolSize )
+    {
+        kDebug() << "stopping unused server on port" << server->port();
+        server->stop();
+        server->deleteLater();
+        return;
+    }
+    connect(server, SIGNAL(died(InfinotedProcess*)), this, SLOT(poolServerLost(InfinotedProcess*)));
+    poolServerReady(server);
+}
+
+void ServerManager::replenish()
+{
+    if ( m_useSharedServer ) {
+        // Only one server is ever needed
+        sharedServer();
+        return;
+    }
+    while ( m_idleServers.size() + m_startingServers.size() < m_poolSize ) {
+        InfinotedProcess* server = new InfinotedProcess(this);
+        m_startingServers << server;
+        connect(server, SIGNAL(ready(InfinotedProcess*)), this, SLOT(poolServerReady(InfinotedProcess*)));
+        connect(server, SIGNAL(failed(InfinotedProcess*)), this, SLOT(poolServerLost(InfinotedProcess*)));
+        connect(server, SIGNAL(died(InfinotedProcess*)), this, SLOT(poolServerLost(InfinotedProcess*)));
+        server->start();
+    }
+}
+
+bool ServerManager::useSharedServer() const
+{
+    return m_useSharedServer;
+}
+
+InfinotedProcess* ServerManager::sharedServer()
+{
+    if ( ! m_sharedServer ) {
+        m_sharedServer = new InfinotedProcess(this);
+        connect(m_sharedServer, SIGNAL(failed(InfinotedProcess*)), this, SLOT(sharedServerLost(InfinotedProcess*)));
+        connect(m_sharedServer, SIGNAL(died(InfinotedProcess*)), this, SLOT(sharedServerLost(InfinotedProcess*)));
+        m_sharedServer->start();
+    }
+    return m_sharedServer;
+}
+
+void ServerManager::sharedServerLost(InfinotedProcess* server)
+{
+    // The next tube will start a new one
+    if ( server == m_sharedServer ) {
+        m_sharedServer = 0;
+    }
+    server->deleteLater();
+}
+
+void ServerManager::poolServerReady(InfinotedProcess* server)
+{
+    m_startingServers.removeAll(server);
+    m_idleServers << server;
+    m_idleSince[server].start();
+    if ( m_idleTimeout > 0 && ! m_reapTimer.isActive() ) {
+        m_reapTimer.start();
+    }
+}
+
+void ServerManager::poolServerLost(InfinotedProcess* server)
+{
+    // Don't try to replace servers which failed to start, it would likely fail again
+    const bool wasRunning = m_idleServers.contains(server);
+    m_startingServers.removeAll(server);
+    m_idleServers.removeAll(server);
+    m_idleSince.remove(server);
+    server->deleteLater();
+    if ( wasRunning ) {
+        replenish();
+    }
+}
+
+void ServerManager::reapIdleServers()
+{
+    foreach ( InfinotedProcess* server, m_idleServers ) {
+        if ( m_idleSince.value(server).elapsed() > m_idleTimeout ) {
+            kDebug() << "stopping unused server on port" << server->port();
+            m_idleServers.removeAll(server);
+            m_idleSince.remove(server);
+            server->stop();
+            server->deleteLater();
+        }
+    }
+    if ( m_idleServers.isEmpty() ) {
+        m_reapTimer.stop();
+    }
+}
+
 void ServerManager::shutdown()
 {
     qDeleteAll(m_serverProcesses);
     m_serverProcesses.clear();
+    m_reapTimer.stop();
+    qDeleteAll(m_startingServers);
+    m_startingServers.clear();
+    qDeleteAll(m_idleServers);
+    m_idleServers.clear();
+    m_idleSince.clear();
+    delete m_sharedServer;
+    m_sharedServer = 0;
 }
 
 #include "inftube.moc"
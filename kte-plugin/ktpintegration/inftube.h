@@ -38,6 +38,9 @@
 #include <KUrl>
 #include <KDebug>
 #include <QTcpSocket>
+#include <QHash>
+#include <QTimer>
+#include <QTime>
 
 #include "inftube_export.h"
 
@@ -48,6 +51,7 @@ namespace Tp {
 }
 
 class ServerManager;
+class InfinotedProcess;
 
 typedef QList<QVariantMap> ChannelList;
 Q_DECLARE_METATYPE(ChannelList)
@@ -91,6 +95,24 @@ public:
      */
     KUrl localUrl() const;
 
+    /**
+     * @brief Get the directory on the server which belongs to this tube.
+     * This is "/" unless the server is shared between several tubes.
+     */
+    const QString& rootDirectory() const;
+
+    /**
+     * @brief Read the tube's root directory from the tube parameters.
+     */
+    void setRootDirectoryFromParameters(const QVariantMap& parameters);
+
+    /**
+     * @brief Build the absolute server path of a document in a tube's root directory.
+     * @param rootDirectory the tube's root directory, an empty string means "/"
+     * @param path the document's path relative to rootDirectory
+     */
+    static QString tubePath(const QString& rootDirectory, const QString& path);
+
     /**
      * @brief Set a nickname with all "bad" characters properly escaped.
      */
@@ -112,6 +134,7 @@ signals:
 protected:
     unsigned int m_port;
     QString m_nickname;
+    QString m_rootDirectory;
 };
 
 /**
@@ -183,7 +206,8 @@ private:
 public slots:
     void onTubeRequestReady(Tp::PendingOperation*);
     void onTubeReady(Tp::PendingOperation*);
-    void jobFinished(KJob* job);
+    void documentUploaded(const KUrl& url);
+    void uploadFinished(KJob* job);
 
 signals:
     void collaborativeDocumentReady(KUrl url);
@@ -214,18 +238,63 @@ public slots:
     void tubeClosed(Tp::AccountPtr,Tp::OutgoingStreamTubeChannelPtr,QString,QString);
     void targetPresenceChanged(Tp::Presence);
 
+private slots:
+    /**
+     * @brief Called when the server started for a requested tube accepts connections.
+     */
+    void serverReady(InfinotedProcess* server);
+    /**
+     * @brief Called when the server for a requested tube could not be started.
+     */
+    void serverFailed(InfinotedProcess* server);
+    /**
+     * @brief Called when the initial documents for a tube were uploaded to its server.
+     */
+    void uploadFinished(KJob* job);
+    /**
+     * @brief Called when the directory for a tube on the shared server was created.
+     */
+    void tubeDirectoryCreated(KJob* job);
+
 private:
+    /// A tube which was requested, but for which the server is not running yet
+    struct PendingTube {
+        Tp::AccountPtr account;
+        Tp::OutgoingStreamTubeChannelPtr channel;
+        QVariantMap hints;
+        bool sharedServer;
+        // only valid once the server is running
+        unsigned short port;
+        QString rootDirectory;
+    };
+
     mutable QList<Tp::StreamTubeChannelPtr> m_channels;
     Tp::StreamTubeServerPtr m_tubeServer;
-    QList<QProcess*> m_serverProcesses;
+    QList<InfinotedProcess*> m_serverProcesses;
+    QMultiHash<InfinotedProcess*, PendingTube> m_pendingTubes;
+    /// Tubes for which the server is running, but the initial documents are still being uploaded
+    QHash<KJob*, PendingTube> m_uploadingTubes;
+    /// Tubes on the shared server whose directory is still being created
+    QHash<KJob*, PendingTube> m_creatingDirectories;
     bool m_hasCreatedChannel;
+    int m_tubeCount;
 
     /**
-     * @brief Starts infinoted and provides the port
-     *
-     * @return bool true if successful, else false.
+     * @brief Upload the tube's initial documents to the given server, then publish the tube.
+     * @param rootDirectory the directory on the server which belongs to the tube
      */
-    bool startInfinoted(unsigned short* port);
+    void exportTube(const PendingTube& tube, unsigned short port, const QString& rootDirectory);
+
+    /**
+     * @brief Export the tube's local endpoint and open the initial documents.
+     */
+    void publishTube(const PendingTube& tube);
+
+    /**
+     * @brief Create a new, empty directory for a tube on the shared server, then export the tube to it.
+     * @param port the port the shared server listens on
+     */
+    void createTubeDirectory(const PendingTube& tube, unsigned short port);
 };
 
 INFTUBE_EXPORT QDBusArgument &operator<<(QDBusArgument &argument, const ChannelList& message);
@@ -266,6 +335,15 @@ private:
 
 /**
  * @brief Container for all tubes offered over time and for the Tp objects which are only needed once
+ *
+ * It also keeps a small pool of idle, already running infinoted instances,
+ * so incoming tubes don't have to wait for a server to start up.
+ * The pool size and the time after which unused servers are stopped are read from
+ * the "poolSize" and "idleTimeout" (in seconds) entries of the "server" config group.
+ *
+ * If built with ENABLE_SHARED_SERVER and "sharedServer" is set in the same group,
+ * a single infinoted is used for all tubes instead, and each tube gets its own
+ * directory on it. The directories are not isolated from each other though.
  */
 class ServerManager : public QObject {
 Q_OBJECT
@@ -275,14 +353,58 @@ public:
 
     void add(InfTubeServer* server);
 
+    /**
+     * @brief Take a running, unused server out of the pool.
+     * The caller becomes responsible for the returned object.
+     * @return InfinotedProcess* a server which accepts connections, or 0 if the pool is empty
+     */
+    InfinotedProcess* takeServer();
+
+    /**
+     * @brief Hand back a running server obtained from takeServer() which ended up unused.
+     * It is put back into the pool if there is room, and stopped otherwise.
+     */
+    void returnServer(InfinotedProcess* server);
+
+    /**
+     * @brief Start servers in the background until the pool is full.
+     */
+    void replenish();
+
+    /**
+     * @brief Whether all tubes should be exported to the same server.
+     */
+    bool useSharedServer() const;
+
+    /**
+     * @brief Get the server which is shared between all tubes, starting it if necessary.
+     * Check isReady() on the returned object before using it. The manager keeps ownership.
+     */
+    InfinotedProcess* sharedServer();
+
     Tp::AccountManagerPtr accountManager;
 
 private:
     QList<InfTubeServer*> m_serverProcesses;
+    /// Servers which are ready and waiting to be used
+    QList<InfinotedProcess*> m_idleServers;
+    /// Servers which are still starting up and will be put into the pool afterwards
+    QList<InfinotedProcess*> m_startingServers;
+    /// Since when each server in m_idleServers is waiting
+    QHash<InfinotedProcess*, QTime> m_idleSince;
+    QTimer m_reapTimer;
+    InfinotedProcess* m_sharedServer;
+    int m_poolSize;
+    int m_idleTimeout;
+    bool m_useSharedServer;
     void initialize();
 
 private slots:
     void shutdown();
+    void poolServerReady(InfinotedProcess* server);
+    void poolServerLost(InfinotedProcess* server);
+    void reapIdleServers();
+    void sharedServerLost(InfinotedProcess* server);
 };
 
 #endif
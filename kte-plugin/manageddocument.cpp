@@ -22,6 +22,11 @@
 #include "manageddocument.h"
 
 #include "documentchangetracker.h"
+#include "remoteselectiontracker.h"
+#include "usersmodel.h"
+#include "offlineeditlog.h"
+#include "ktecollaborativeplugin.h"
+#include "subscriptionscheduler.h"
 #include "common/connection.h"
 #include "common/utils.h"
 #include <common/noteplugin.h>
@@ -49,11 +54,11 @@
 
 using namespace QInfinity;
 
-ManagedDocument::ManagedDocument(KTextEditor::Document* document, BrowserModel* browserModel, NotePlugin* plugin, Kobby::Connection* connection, QObject* parent)
+ManagedDocument::ManagedDocument(KTextEditor::Document* document, KteCollaborativePlugin* owner, NotePlugin* plugin, Kobby::Connection* connection, QObject* parent)
     : QObject(parent)
     , m_textBuffer(0)
     , m_document(document)
-    , m_browserModel(browserModel)
+    , m_owner(owner)
     , m_notePlugin(plugin)
     , m_connection(connection)
     , m_subscribed(false)
@@ -63,7 +68,9 @@ ManagedDocument::ManagedDocument(KTextEditor::Document* document, BrowserModel*
     , m_sessionStatus(QInfinity::Session::Closed)
     , m_localSavePath()
     , m_changeTracker(new DocumentChangeTracker(this))
-    , m_connectionRetries(0)
+    , m_selectionTracker(new RemoteSelectionTracker(this))
+    , m_usersModel(new UsersModel(this))
+    , m_offlineLog(0)
 {
     kDebug() << "now managing document" << document << document->url();
     // A document must not be edited before it is connected, since changes done will
@@ -71,11 +78,17 @@ ManagedDocument::ManagedDocument(KTextEditor::Document* document, BrowserModel*
     document->setReadWrite(false);
     connect(m_connection, SIGNAL(disconnected(Connection*)),
             this, SLOT(disconnected(Connection*)));
+    connect(m_connection, SIGNAL(statusChanged(Connection*,QInfinity::XmlConnection::Status)),
+            this, SLOT(connectionStatusChanged(Connection*,QInfinity::XmlConnection::Status)));
 }
 
 ManagedDocument::~ManagedDocument()
 {
+    if ( m_ready ) {
+        m_changeTracker->saveAuthorship();
+    }
     unsubscribe();
+    delete m_offlineLog;
 }
 
 bool ManagedDocument::saveCopy() const
@@ -101,16 +114,15 @@ bool ManagedDocument::saveCopy() const
 
 QInfinity::Browser* ManagedDocument::browser() const
 {
-    if ( ! m_connection->xmppConnection() ) {
-        return 0;
+    if ( ! m_browser ) {
+        m_browser = m_owner->browserForConnection(m_connection);
     }
-    for ( int i = 0; i < m_browserModel->rowCount(); i++ ) {
-        ConnectionItem* item = dynamic_cast<ConnectionItem*>(m_browserModel->item(i));
-        if ( item && item->connection() == static_cast<QInfinity::XmlConnection*>(m_connection->xmppConnection()) ) {
-            return item->browser();
-        }
-    }
-    return 0;
+    return m_browser;
+}
+
+void ManagedDocument::connectionStatusChanged(Connection* , QInfinity::XmlConnection::Status )
+{
+    m_browser.clear();
 }
 
 Kobby::Connection* ManagedDocument::connection() const
@@ -121,6 +133,7 @@ Kobby::Connection* ManagedDocument::connection() const
 void ManagedDocument::unsubscribe()
 {
     kDebug() << "should unsubscribe document";
+    cancelLookup();
     m_ready = false;
     if ( m_infDocument ) {
         m_infDocument->leave();
@@ -145,30 +158,50 @@ void ManagedDocument::subscribe()
     }
     m_subscribed = true;
     kDebug() << "beginning subscription for" << m_document->url();
-    IterLookupHelper* helper = new IterLookupHelper(m_document->url().path(KUrl::RemoveTrailingSlash), browser());
-    connect(helper, SIGNAL(done(QInfinity::BrowserIter)),
-            this, SLOT(finishSubscription(QInfinity::BrowserIter)));
-    connect(helper, SIGNAL(failed()),
-            this, SLOT(lookupFailed()));
-    helper->setDeleteOnFinish(true);
-    helper->begin();
+    SubscriptionScheduler* scheduler = SubscriptionScheduler::forBrowser(browser(), m_connection);
+    connect(scheduler, SIGNAL(found(QString,QInfinity::BrowserIter)),
+            this, SLOT(lookupFinished(QString,QInfinity::BrowserIter)), Qt::UniqueConnection);
+    connect(scheduler, SIGNAL(failed(QString)),
+            this, SLOT(lookupFailed(QString)), Qt::UniqueConnection);
+    scheduler->lookup(lookupPath());
+}
+
+void ManagedDocument::cancelLookup()
+{
+    QInfinity::Browser* browser = this->browser();
+    // Don't create a scheduler just to cancel nothing
+    SubscriptionScheduler* scheduler = browser ? browser->findChild<SubscriptionScheduler*>() : 0;
+    if ( ! scheduler ) {
+        return;
+    }
+    scheduler->disconnect(this);
+    scheduler->cancel(lookupPath());
+}
+
+QString ManagedDocument::lookupPath() const
+{
+    return m_document->url().path(KUrl::RemoveTrailingSlash);
+}
+
+void ManagedDocument::lookupFinished(const QString& path, QInfinity::BrowserIter iter)
+{
+    if ( path != lookupPath() ) {
+        return;
+    }
+    sender()->disconnect(this);
+    finishSubscription(iter);
 }
 
-void ManagedDocument::lookupFailed()
+void ManagedDocument::lookupFailed(const QString& path)
 {
-    // If the lookup fails, try again after a few seconds.
-    // TODO this is a workaround for race conditions in the "file added" notifications, fix it!
-    if ( m_connectionRetries < 5 ) {
-        connect(browser(), SIGNAL(nodeAdded(BrowserIter)), SLOT(subscribe()));
-        QTimer::singleShot(3000, this, SLOT(subscribe()));
-    }
-    else {
-        unsubscribe();
-        KMessageBox::error(document()->widget(),
-                           i18n("Failed to open file %1, make sure it exists.", document()->url().url()));
-        document()->closeUrl();
-    }
-    m_connectionRetries += 1;
+    if ( path != lookupPath() ) {
+        return;
+    }
+    sender()->disconnect(this);
+    unsubscribe();
+    KMessageBox::error(document()->widget(),
+                       i18n("Failed to open file %1, make sure it exists.", document()->url().url()));
+    document()->closeUrl();
 }
 
 void ManagedDocument::subscriptionDone(QInfinity::BrowserIter iter, QPointer< QInfinity::SessionProxy > proxy)
@@ -192,6 +225,9 @@ void ManagedDocument::subscriptionDone(QInfinity::BrowserIter iter, QPointer< QI
             this, SLOT(synchronizationComplete(Document*)));
     connect(m_infDocument, SIGNAL(loadStateChanged(Document*,Document::LoadState)),
             this, SIGNAL(loadStateChanged(Document*,Document::LoadState)));
+    if ( ! m_rejoinUserName.isEmpty() ) {
+        m_infDocument->setPreferredUserName(m_rejoinUserName);
+    }
     m_textBuffer->setSession(proxy->session());
     emit synchronizationBegins(this);
 }
@@ -226,6 +262,9 @@ void ManagedDocument::synchronizationComplete(Kobby::Document* /*document*/)
     // Only after the connection has been established and synchronization is finished,
     // the user is allowed to edit the document.
     document()->setReadWrite(true);
+    // before replaying, so the text still is what was saved if nobody changed it meanwhile
+    m_changeTracker->restoreAuthorship();
+    replayOfflineEdits();
     m_ready = true;
     emit documentReady(this);
 }
@@ -237,15 +276,143 @@ bool ManagedDocument::isReady() const
 
 void ManagedDocument::disconnected(Kobby::Connection* )
 {
-    // If a connection for a document gets disconnected, it should be
-    // set to read-only, to prevent a user from further editing the document
-    // without saving it somewhere.
-    document()->setReadWrite(false);
+    const bool wasReady = m_ready;
     m_ready = false;
+    if ( wasReady ) {
+        // the text is cleared when synchronizing again
+        m_changeTracker->saveAuthorship();
+    }
+    // the other users' carets are lost with the session
+    m_selectionTracker->clear();
+    if ( ! m_connection->willReconnect() ) {
+        // If a connection for a document gets disconnected, it should be
+        // set to read-only, to prevent a user from further editing the document
+        // without saving it somewhere.
+        document()->setReadWrite(false);
+        return;
+    }
+    if ( ! m_subscribed ) {
+        // Either not subscribed yet, or a reconnect attempt failed; nothing changes.
+        return;
+    }
+    // Forget about the session, it can't be resumed; subscribeNewDocuments() will
+    // subscribe this document again when the browser is connected again.
+    if ( m_textBuffer && m_textBuffer->user() ) {
+        m_rejoinUserName = m_textBuffer->user()->name();
+    }
+    kDebug() << "connection lost, will resubscribe as" << m_rejoinUserName;
+    if ( m_proxy && m_proxy->session() ) {
+        m_proxy->session()->disconnect(this);
+    }
+    if ( m_infDocument ) {
+        m_infDocument->disconnect(this);
+        m_infDocument->deleteLater();
+        m_infDocument = 0;
+    }
+    if ( m_textBuffer ) {
+        m_textBuffer->shutdown();
+        m_textBuffer = 0;
+    }
+    m_proxy.clear();
+    m_sessionStatus = Session::Closed;
+    m_subscribed = false;
+    m_usersModel->resetUserTable();
+
+    if ( ! wasReady ) {
+        // The document is not completely synchronized, editing it makes no sense.
+        document()->setReadWrite(false);
+        return;
+    }
+    // Keep the document editable; the edits are replayed once it was synchronized again.
+    m_offlineLog = new OfflineEditLog(document()->text());
+    m_offlineLineStarts.clear();
+    connect(document(), SIGNAL(textInserted(KTextEditor::Document*,KTextEditor::Range)),
+            this, SLOT(offlineTextInserted(KTextEditor::Document*,KTextEditor::Range)));
+    connect(document(), SIGNAL(textRemoved(KTextEditor::Document*,KTextEditor::Range,QString)),
+            this, SLOT(offlineTextRemoved(KTextEditor::Document*,KTextEditor::Range,QString)));
+}
+
+static KTextEditor::Cursor cursorForOffset(const KTextEditor::Document* document, int offset)
+{
+    int line = 0;
+    while ( line < document->lines() - 1 && offset > document->lineLength(line) ) {
+        offset -= document->lineLength(line) + 1;
+        line++;
+    }
+    return KTextEditor::Cursor(line, qMin(offset, document->lineLength(line)));
+}
+
+int ManagedDocument::offlineOffset(const KTextEditor::Cursor& cursor)
+{
+    // An edit starting at cursor only moves the lines after cursor's line, so the
+    // offsets up to it are still valid from the previous edits and usually cached.
+    const int line = cursor.line();
+    while ( m_offlineLineStarts.size() <= line ) {
+        const int previous = m_offlineLineStarts.size() - 1;
+        m_offlineLineStarts.append(previous < 0 ? 0
+                                   : m_offlineLineStarts.at(previous) + document()->lineLength(previous) + 1);
+    }
+    const int offset = m_offlineLineStarts.at(line) + cursor.column();
+    m_offlineLineStarts.resize(line + 1);
+    return offset;
+}
+
+void ManagedDocument::offlineTextInserted(KTextEditor::Document* document, const KTextEditor::Range& range)
+{
+    Q_ASSERT(m_offlineLog);
+    m_offlineLog->recordInsert(offlineOffset(range.start()), document->text(range));
+}
+
+void ManagedDocument::offlineTextRemoved(KTextEditor::Document* /*document*/, const KTextEditor::Range& range,
+                                         const QString& oldText)
+{
+    Q_ASSERT(m_offlineLog);
+    m_offlineLog->recordErase(offlineOffset(range.start()), oldText.length());
+}
+
+void ManagedDocument::stopRecordingOfflineEdits()
+{
+    if ( ! m_offlineLog ) {
+        return;
+    }
+    // The document will be replaced by the server's version now, which must not be recorded;
+    // further edits would be lost, so don't allow any until the offline edits are replayed.
+    document()->disconnect(this, SLOT(offlineTextInserted(KTextEditor::Document*,KTextEditor::Range)));
+    document()->disconnect(this, SLOT(offlineTextRemoved(KTextEditor::Document*,KTextEditor::Range,QString)));
+    document()->setReadWrite(false);
+    m_offlineLineStarts.clear();
+}
+
+void ManagedDocument::replayOfflineEdits()
+{
+    if ( ! m_offlineLog ) {
+        return;
+    }
+    const OfflineEditLog::Operations operations = m_offlineLog->rebase(document()->text());
+    delete m_offlineLog;
+    m_offlineLog = 0;
+    kDebug() << "replaying" << operations.size() << "edits done while offline";
+    // The text buffer sends the edits to the server as usual; doing them in one
+    // editing transaction makes them a single undo step.
+    document()->startEditing();
+    foreach ( const OfflineEditLog::Operation& op, operations ) {
+        const KTextEditor::Cursor start = cursorForOffset(document(), op.offset);
+        if ( op.type == OfflineEditLog::Operation::Insert ) {
+            document()->insertText(start, op.text);
+        }
+        else {
+            const KTextEditor::Cursor end = cursorForOffset(document(), op.offset + op.erasedLength);
+            document()->removeText(KTextEditor::Range(start, end));
+        }
+    }
+    document()->endEditing();
 }
 
 UserTable* ManagedDocument::userTable() const
 {
+    if ( ! m_proxy ) {
+        return 0;
+    }
     return m_proxy->session()->userTable().data();
 }
 
@@ -258,6 +425,13 @@ void ManagedDocument::sessionStatusChanged()
 {
     m_sessionStatus = m_proxy->session()->status();
     kDebug() << "session status changed to " << m_proxy->session()->status() << "on" << document()->url();
+    if ( m_sessionStatus == Session::Closed && m_connection->autoReconnect()
+         && m_connection->status() != QInfinity::XmlConnection::Open )
+    {
+        // The connection is gone; disconnected() takes care of resubscribing.
+        kDebug() << "Session was closed because the connection was lost.";
+        return;
+    }
     if ( m_sessionStatus == Session::Closed ) {
         kDebug() << "Session was closed, disconnecting.";
         unrecoverableError(infTextDocument(),
@@ -274,6 +448,7 @@ void ManagedDocument::subscriptionFailed(GError* error)
 void ManagedDocument::finishSubscription(QInfinity::BrowserIter iter)
 {
     kDebug() << "finishing subscription with iter " << iter.path();
+    stopRecordingOfflineEdits();
     if ( iter.isDirectory() ) {
         unrecoverableError(infTextDocument(), i18n("The URL you tried to open is a directory, not a document."));
         return;
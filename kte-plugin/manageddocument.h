@@ -23,6 +23,7 @@
 #define KOBBY_MANAGEDDOCUMENT_H
 
 #include <QObject>
+#include <QVector>
 
 #include <KTextEditor/Document>
 
@@ -35,6 +36,10 @@
 #include "common/connection.h"
 
 class DocumentChangeTracker;
+class RemoteSelectionTracker;
+class UsersModel;
+class OfflineEditLog;
+class KteCollaborativePlugin;
 using Kobby::Connection;
 using Kobby::Document;
 
@@ -50,12 +55,12 @@ public:
      * @brief Create a new managed document instance.
      * Doing so will initiate the synchronization process for the given KTE::Document.
      * @param document The document from KTE to be synchronized, usually retrieved from the addDocument() method of the plugin
-     * @param browserModel The browser model; the plugin instance knows about it
+     * @param owner The plugin instance, used to find the browser for the connection
      * @param plugin The note plugin; the plugin instance knows about it
      * @param connection The connection; the plugin instance knows about it
      * @param parent parent object for lifetime management purposes
      */
-    ManagedDocument(KTextEditor::Document* document, QInfinity::BrowserModel* browserModel,
+    ManagedDocument(KTextEditor::Document* document, KteCollaborativePlugin* owner,
                     QInfinity::NotePlugin* plugin, Kobby::Connection* connection, QObject* parent = 0);
 
     virtual ~ManagedDocument();
@@ -96,9 +101,16 @@ public:
     inline DocumentChangeTracker* changeTracker() const {
         return m_changeTracker;
     };
+    inline RemoteSelectionTracker* selectionTracker() const {
+        return m_selectionTracker;
+    };
+    inline UsersModel* usersModel() const {
+        return m_usersModel;
+    };
 
     /**
      * @brief Returns the Browser for the document's connection
+     * The result is cached until the connection's status changes.
      */
     QInfinity::Browser* browser() const;
 
@@ -149,9 +161,17 @@ public slots:
 
     /**
      * @brief Invoked when a connection breaks.
+     * If the connection reconnects automatically, the session is dropped, and the
+     * document will be subscribed again (with the same user) once the connection is back.
+     * The document stays editable meanwhile; the edits are replayed after synchronizing.
      */
     void disconnected(Connection*);
 
+    /**
+     * @brief Invoked when the connection's status changes; forgets the cached browser.
+     */
+    void connectionStatusChanged(Connection*, QInfinity::XmlConnection::Status);
+
     /**
      * @brief Invoked when an error which cannot be recovered happens.
      * The document will  be closed after the error has been displayed.
@@ -159,12 +179,16 @@ public slots:
     void unrecoverableError(Document*,QString);
 
     /**
-     * @brief Invoked when an error occurs in looking up the iter for the document.
-     * That usually means the file doesn't exist.
-     * @note If the file does not exist, this will try to create the file, once.
-     * @return void
+     * @brief Invoked when the subscription scheduler found the iter for a path.
+     * Ignored unless the path is the one of this document.
      */
-    void lookupFailed();
+    void lookupFinished(const QString& path, QInfinity::BrowserIter iter);
+
+    /**
+     * @brief Invoked when the subscription scheduler gave up looking for a path.
+     * That usually means the file doesn't exist. Ignored unless the path is the one of this document.
+     */
+    void lookupFailed(const QString& path);
 
     /**
      * @brief Tells if the document is fully ready (i.e. if documentReady() has been emitted)
@@ -176,6 +200,12 @@ public slots:
      */
     void subscriptionFailed(GError*);
 
+    /**
+     * @brief Record local changes while the connection is lost, see m_offlineLog.
+     */
+    void offlineTextInserted(KTextEditor::Document*, const KTextEditor::Range&);
+    void offlineTextRemoved(KTextEditor::Document*, const KTextEditor::Range&, const QString&);
+
 signals:
     /**
      * @brief Emitted when a document is completely synchronized and ready to be used (user can start typing etc).
@@ -209,7 +239,9 @@ signals:
 private:
     Kobby::KDocumentTextBuffer* m_textBuffer;
     KTextEditor::Document* m_document;
-    QInfinity::BrowserModel* m_browserModel;
+    KteCollaborativePlugin* m_owner;
+    // cached result of browser()
+    mutable QPointer<QInfinity::Browser> m_browser;
     QInfinity::NotePlugin* m_notePlugin;
     Kobby::Connection* m_connection;
     bool m_subscribed;
@@ -223,7 +255,43 @@ private:
     // local URL to copy the document to if requested
     QString m_localSavePath;
     DocumentChangeTracker* m_changeTracker;
-    int m_connectionRetries;
+    RemoteSelectionTracker* m_selectionTracker;
+    UsersModel* m_usersModel;
+    // name of the local user in the session which was lost, to rejoin with after reconnecting
+    QString m_rejoinUserName;
+    // Edits done while the connection was lost; they are replayed once the document
+    // was synchronized again. Null unless the document is edited offline.
+    OfflineEditLog* m_offlineLog;
+    // Character offsets at which the first lines of the document start while recording
+    // offline edits. Entries past the line of the last edit are dropped, see offlineOffset().
+    QVector<int> m_offlineLineStarts;
+
+    /**
+     * @brief Convert @p cursor to a character offset for the offline log, and forget the
+     * cached offsets of all lines below it since the edit at @p cursor may have moved them.
+     * Typing costs constant time this way instead of time linear in the cursor's line.
+     */
+    int offlineOffset(const KTextEditor::Cursor& cursor);
+
+    /**
+     * @brief Stop recording offline edits; the log is kept for replayOfflineEdits().
+     */
+    void stopRecordingOfflineEdits();
+
+    /**
+     * @brief Apply the offline edits to the freshly synchronized document, which sends them to the server.
+     */
+    void replayOfflineEdits();
+
+    /**
+     * @brief The path of the document on the server, as used for looking it up
+     */
+    QString lookupPath() const;
+
+    /**
+     * @brief Stop looking up the document on the server, if that is still going on.
+     */
+    void cancelLookup();
 };
 
 typedef QMap<KTextEditor::Document*, ManagedDocument*> ManagedDocumentList;
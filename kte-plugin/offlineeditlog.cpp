@@ -0,0 +1,265 @@
+/* This file is part of the Kobby plugin
+ * Copyright (C) 2013 Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "offlineeditlog.h"
+
+#include <KDebug>
+
+typedef OfflineEditLog::Operation Operation;
+typedef OfflineEditLog::Operations Operations;
+
+Operation OfflineEditLog::Operation::insert(int offset, const QString& text)
+{
+    Operation op;
+    op.type = Insert;
+    op.offset = offset;
+    op.text = text;
+    op.erasedLength = 0;
+    return op;
+}
+
+Operation OfflineEditLog::Operation::erase(int offset, int length)
+{
+    Operation op;
+    op.type = Erase;
+    op.offset = offset;
+    op.erasedLength = length;
+    return op;
+}
+
+bool OfflineEditLog::Operation::operator==(const Operation& other) const
+{
+    return type == other.type && offset == other.offset && text == other.text
+           && erasedLength == other.erasedLength;
+}
+
+OfflineEditLog::OfflineEditLog(const QString& baseText)
+    : m_baseText(baseText)
+{
+}
+
+void OfflineEditLog::recordInsert(int offset, const QString& text)
+{
+    if ( text.isEmpty() ) {
+        return;
+    }
+    if ( ! m_operations.isEmpty() ) {
+        Operation& last = m_operations.last();
+        if ( last.type == Operation::Insert && offset == last.offset + last.text.length() ) {
+            last.text.append(text);
+            return;
+        }
+    }
+    m_operations << Operation::insert(offset, text);
+}
+
+void OfflineEditLog::recordErase(int offset, int length)
+{
+    if ( length <= 0 ) {
+        return;
+    }
+    if ( ! m_operations.isEmpty() ) {
+        Operation& last = m_operations.last();
+        if ( last.type == Operation::Erase ) {
+            // backspace
+            if ( offset + length == last.offset ) {
+                last.offset = offset;
+                last.erasedLength += length;
+                return;
+            }
+            // delete
+            if ( offset == last.offset ) {
+                last.erasedLength += length;
+                return;
+            }
+        }
+    }
+    m_operations << Operation::erase(offset, length);
+}
+
+bool OfflineEditLog::isEmpty() const
+{
+    return m_operations.isEmpty();
+}
+
+const QString& OfflineEditLog::baseText() const
+{
+    return m_baseText;
+}
+
+const Operations& OfflineEditLog::operations() const
+{
+    return m_operations;
+}
+
+QString OfflineEditLog::localText() const
+{
+    return apply(m_baseText, m_operations);
+}
+
+QString OfflineEditLog::apply(const QString& text, const Operations& operations)
+{
+    QString result = text;
+    foreach ( const Operation& op, operations ) {
+        const int offset = qBound(0, op.offset, result.length());
+        if ( op.type == Operation::Insert ) {
+            result.insert(offset, op.text);
+        }
+        else {
+            result.remove(offset, op.erasedLength);
+        }
+    }
+    return result;
+}
+
+/**
+ * Transform @p op, which applies to the same text as @p against, such that it
+ * applies to the text after @p against was done.
+ * If both insert at the same position, the text of @p op goes first if @p opWinsTies.
+ */
+static Operations transform(const Operation& op, const Operation& against, bool opWinsTies)
+{
+    Operations result;
+    if ( op.length() == 0 ) {
+        return result;
+    }
+    const int otherStart = against.offset;
+    const int otherEnd = against.offset + against.length();
+    if ( op.type == Operation::Insert ) {
+        Operation transformed = op;
+        if ( against.type == Operation::Insert ) {
+            if ( op.offset > otherStart || ( op.offset == otherStart && ! opWinsTies ) ) {
+                transformed.offset += against.length();
+            }
+        }
+        else if ( op.offset >= otherEnd ) {
+            transformed.offset -= against.length();
+        }
+        else if ( op.offset > otherStart ) {
+            // the text around the insertion is gone, keep the insertion where it was
+            transformed.offset = otherStart;
+        }
+        result << transformed;
+        return result;
+    }
+
+    const int start = op.offset;
+    const int end = op.offset + op.erasedLength;
+    if ( against.type == Operation::Insert ) {
+        if ( otherStart <= start ) {
+            result << Operation::erase(start + against.length(), op.erasedLength);
+        }
+        else if ( otherStart >= end ) {
+            result << op;
+        }
+        else {
+            // The inserted text must survive, so remove what is left and right of it.
+            result << Operation::erase(start, otherStart - start);
+            result << Operation::erase(start + against.length(), end - otherStart);
+        }
+        return result;
+    }
+
+    // Both are removals; only remove what the other one did not remove already.
+    const int before = qMax(0, qMin(end, otherStart) - start);
+    const int after = qMax(0, end - qMax(start, otherEnd));
+    if ( before + after > 0 ) {
+        int newStart = start;
+        if ( start >= otherEnd ) {
+            newStart = start - against.length();
+        }
+        else if ( start > otherStart ) {
+            newStart = otherStart;
+        }
+        result << Operation::erase(newStart, before + after);
+    }
+    return result;
+}
+
+/**
+ * Transform the sequences @p a and @p b, which both apply to the same text, against each other:
+ * afterwards, @p a applies to the text after the original @p b was done, and vice versa.
+ */
+static void transformSequences(Operations& a, Operations& b, bool aWinsTies)
+{
+    if ( a.isEmpty() || b.isEmpty() ) {
+        return;
+    }
+    if ( a.size() == 1 && b.size() == 1 ) {
+        const Operation first = a.first();
+        const Operation second = b.first();
+        a = transform(first, second, aWinsTies);
+        b = transform(second, first, ! aWinsTies);
+        return;
+    }
+    if ( a.size() > 1 ) {
+        Operations head;
+        head << a.first();
+        Operations tail = a.mid(1);
+        transformSequences(head, b, aWinsTies);
+        transformSequences(tail, b, aWinsTies);
+        a = head + tail;
+        return;
+    }
+    Operations head;
+    head << b.first();
+    Operations tail = b.mid(1);
+    transformSequences(a, head, aWinsTies);
+    transformSequences(a, tail, aWinsTies);
+    b = head + tail;
+}
+
+Operations OfflineEditLog::rebase(const QString& serverText) const
+{
+    // Find the region of the base text which was changed on the server.
+    const int maxCommon = qMin(m_baseText.length(), serverText.length());
+    int prefix = 0;
+    while ( prefix < maxCommon && m_baseText.at(prefix) == serverText.at(prefix) ) {
+        prefix++;
+    }
+    int suffix = 0;
+    while ( suffix < maxCommon - prefix
+            && m_baseText.at(m_baseText.length() - suffix - 1) == serverText.at(serverText.length() - suffix - 1) )
+    {
+        suffix++;
+    }
+    Operations remote;
+    const int removed = m_baseText.length() - suffix - prefix;
+    const QString inserted = serverText.mid(prefix, serverText.length() - suffix - prefix);
+    if ( removed > 0 ) {
+        remote << Operation::erase(prefix, removed);
+    }
+    if ( ! inserted.isEmpty() ) {
+        remote << Operation::insert(prefix, inserted);
+    }
+    kDebug() << "server changed" << removed << "characters at" << prefix << "to" << inserted.length() << "characters";
+
+    // The local operations are applied after the remote ones, so they
+    // need to be transformed against them, and the remote ones against each local one.
+    Operations result;
+    foreach ( const Operation& op, m_operations ) {
+        Operations local;
+        local << op;
+        transformSequences(local, remote, false);
+        result += local;
+    }
+    return result;
+}
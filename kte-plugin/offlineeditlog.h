@@ -0,0 +1,105 @@
+/* This file is part of the Kobby plugin
+ * Copyright (C) 2013 Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef OFFLINEEDITLOG_H
+#define OFFLINEEDITLOG_H
+
+#include <QString>
+#include <QList>
+
+/**
+ * @brief Records the edits done to a document while its connection is lost.
+ *
+ * The log remembers the document's text at the time the connection was lost
+ * (the "base" text) and every insertion and removal done locally afterwards.
+ * When the document was synchronized again, rebase() transforms the recorded
+ * operations such that they can be applied to the text the server has now,
+ * which might contain changes done by other users in the meantime.
+ *
+ * All offsets are character offsets into the document's text as returned by
+ * KTextEditor::Document::text(), i.e. utf-16 code units with "\n" line breaks.
+ */
+class OfflineEditLog {
+public:
+    struct Operation {
+        enum Type {
+            Insert,
+            Erase
+        };
+        static Operation insert(int offset, const QString& text);
+        static Operation erase(int offset, int length);
+        int length() const {
+            return type == Insert ? text.length() : erasedLength;
+        };
+        bool operator==(const Operation& other) const;
+
+        Type type;
+        int offset;
+        /// The inserted text, for insertions
+        QString text;
+        /// The amount of characters removed, for removals
+        int erasedLength;
+    };
+    typedef QList<Operation> Operations;
+
+    explicit OfflineEditLog(const QString& baseText);
+
+    /**
+     * @brief Record that @p text was inserted at @p offset.
+     * Typing (i.e. insertions directly following the previous one) is merged into one operation.
+     */
+    void recordInsert(int offset, const QString& text);
+
+    /**
+     * @brief Record that @p length characters were removed at @p offset.
+     * Removals directly preceding or following the previous one are merged into one operation.
+     */
+    void recordErase(int offset, int length);
+
+    bool isEmpty() const;
+    const QString& baseText() const;
+    const Operations& operations() const;
+
+    /**
+     * @brief The base text with all recorded operations applied.
+     */
+    QString localText() const;
+
+    /**
+     * @brief Transform the recorded operations to apply to @p serverText instead of the base text.
+     * The changes which turned the base text into @p serverText are treated as one replaced
+     * region. Text inserted locally inside that region is kept and moved to its beginning,
+     * text removed locally which was also changed remotely stays as the server has it.
+     * If the server text equals the base text, the recorded operations are returned unchanged.
+     */
+    Operations rebase(const QString& serverText) const;
+
+    /**
+     * @brief Apply @p operations to @p text in order, and return the result.
+     */
+    static QString apply(const QString& text, const Operations& operations);
+
+private:
+    QString m_baseText;
+    Operations m_operations;
+};
+
+#endif // OFFLINEEDITLOG_H
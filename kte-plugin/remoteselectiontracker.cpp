@@ -0,0 +1,245 @@
+/*
+ * This file is part of kobby
+ * Copyright 2013  Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "remoteselectiontracker.h"
+#include "manageddocument.h"
+#include "documentchangetracker.h"
+#include "common/utils.h"
+
+#include <libqinfinity/user.h>
+#include <libqinfinity/usertable.h>
+#include <libqinfinity/textsession.h>
+#include <libqinfinity/qgsignal.h>
+
+#include <libinftext/inf-text-session.h>
+#include <libinftext/inf-text-user.h>
+
+#include <KTextEditor/Document>
+#include <KTextEditor/View>
+#include <KTextEditor/MovingInterface>
+#include <KTextEditor/MovingCursor>
+#include <KTextEditor/MovingRange>
+#include <KDebug>
+
+RemoteSelectionTracker::RemoteSelectionTracker(ManagedDocument* const document)
+    : QObject(document)
+    , m_document(document)
+{
+    m_broadcastTimer.setSingleShot(true);
+    m_broadcastTimer.setInterval(100);
+    connect(&m_broadcastTimer, SIGNAL(timeout()), this, SLOT(broadcastSelection()));
+    connect(m_document, SIGNAL(documentReady(ManagedDocument*)),
+            this, SLOT(documentReady(ManagedDocument*)));
+    connect(m_document->document(), SIGNAL(viewCreated(KTextEditor::Document*,KTextEditor::View*)),
+            this, SLOT(viewCreated(KTextEditor::Document*,KTextEditor::View*)));
+    foreach ( KTextEditor::View* view, m_document->document()->views() ) {
+        viewCreated(m_document->document(), view);
+    }
+}
+
+RemoteSelectionTracker::~RemoteSelectionTracker()
+{
+    clear();
+}
+
+void RemoteSelectionTracker::documentReady(ManagedDocument* document)
+{
+    Q_ASSERT(document == m_document);
+    clear();
+    if ( ! m_document->userTable() ) {
+        return;
+    }
+    connect(m_document->userTable(), SIGNAL(userAdded(User*)),
+            this, SLOT(userAdded(User*)), Qt::UniqueConnection);
+    foreach ( const QPointer<User>& user, m_document->userTable()->users() ) {
+        userAdded(user.data());
+    }
+}
+
+void RemoteSelectionTracker::clear()
+{
+    foreach ( unsigned int id, m_users.keys() ) {
+        removeUser(id);
+    }
+}
+
+void RemoteSelectionTracker::userAdded(User* user)
+{
+    if ( ! user ) {
+        return;
+    }
+    connect(user, SIGNAL(statusChanged()), this, SLOT(userStatusChanged()), Qt::UniqueConnection);
+    if ( user->status() != QInfinity::User::Unavailable ) {
+        trackUser(user);
+    }
+}
+
+void RemoteSelectionTracker::userStatusChanged()
+{
+    User* user = qobject_cast<User*>(sender());
+    if ( ! user ) {
+        return;
+    }
+    if ( user->status() == QInfinity::User::Unavailable ) {
+        removeUser(user->id());
+    }
+    else {
+        trackUser(user);
+    }
+}
+
+void RemoteSelectionTracker::trackUser(User* user)
+{
+    const User* localUser = m_document->textBuffer() ? m_document->textBuffer()->user() : 0;
+    if ( m_users.contains(user->id()) || ( localUser && localUser->id() == user->id() )
+         || ! INF_TEXT_IS_USER(user->gobject()) )
+    {
+        return;
+    }
+    KTextEditor::MovingInterface* iface = qobject_cast<KTextEditor::MovingInterface*>(m_document->document());
+    if ( ! iface ) {
+        return;
+    }
+    RemoteUser remote;
+    remote.user = user;
+    remote.caret = iface->newMovingCursor(KTextEditor::Cursor(0, 0));
+    remote.selection = iface->newMovingRange(KTextEditor::Range(0, 0, 0, 0));
+    // in front of the authorship highlighting
+    remote.selection->setZDepth(-10.0);
+    KTextEditor::Attribute::Ptr attrib(new KTextEditor::Attribute);
+    QColor color = ColorHelper::colorForUsername(user->name(), m_document->document()->activeView(),
+                                                 m_document->changeTracker()->usedColors());
+    color.setAlpha(120);
+    attrib->setBackground(color);
+    attrib->setToolTip(user->name());
+    remote.selection->setAttribute(attrib);
+    remote.selectionChanged = new QInfinity::QGSignal(user, "selection-changed",
+                                                      G_CALLBACK(RemoteSelectionTracker::selectionChangedCb), this, this);
+    m_users.insert(user->id(), remote);
+
+    InfTextUser* textUser = INF_TEXT_USER(user->gobject());
+    setSelection(user->id(), inf_text_user_get_caret_position(textUser), inf_text_user_get_selection_length(textUser));
+}
+
+void RemoteSelectionTracker::removeUser(unsigned int id)
+{
+    if ( ! m_users.contains(id) ) {
+        return;
+    }
+    RemoteUser remote = m_users.take(id);
+    delete remote.selectionChanged;
+    delete remote.caret;
+    delete remote.selection;
+    emit caretsChanged();
+}
+
+void RemoteSelectionTracker::selectionChangedCb(InfTextUser* user, unsigned int position, int length,
+                                                int byRequest, void* tracker)
+{
+    // If the selection was only moved because text was changed, the
+    // moving cursor and range have been moved by the editor already.
+    if ( ! byRequest ) {
+        return;
+    }
+    static_cast<RemoteSelectionTracker*>(tracker)->setSelection(inf_user_get_id(INF_USER(user)), position, length);
+}
+
+void RemoteSelectionTracker::setSelection(unsigned int id, unsigned int position, int length)
+{
+    QHash<unsigned int, RemoteUser>::iterator it = m_users.find(id);
+    if ( it == m_users.end() || ! m_document->textBuffer() ) {
+        return;
+    }
+    Kobby::KDocumentTextBuffer* buffer = m_document->textBuffer();
+    const KTextEditor::Cursor caret = buffer->offsetToCursor_kte(position);
+    it->caret->setPosition(caret);
+    if ( length == 0 ) {
+        it->selection->setRange(KTextEditor::Range(caret, caret));
+    }
+    else {
+        const KTextEditor::Cursor other = buffer->offsetToCursor_kte(position + length);
+        it->selection->setRange(KTextEditor::Range(qMin(caret, other), qMax(caret, other)));
+    }
+    emit caretsChanged();
+}
+
+QList<RemoteSelectionTracker::Caret> RemoteSelectionTracker::carets() const
+{
+    QList<Caret> result;
+    foreach ( const RemoteUser& remote, m_users ) {
+        if ( ! remote.user ) {
+            continue;
+        }
+        Caret caret;
+        caret.userName = remote.user->name();
+        caret.color = remote.selection->attribute()->background().color();
+        caret.color.setAlpha(255);
+        caret.position = remote.caret->toCursor();
+        result << caret;
+    }
+    return result;
+}
+
+void RemoteSelectionTracker::viewCreated(KTextEditor::Document* , KTextEditor::View* view)
+{
+    connect(view, SIGNAL(cursorPositionChanged(KTextEditor::View*,KTextEditor::Cursor)),
+            this, SLOT(scheduleBroadcast()));
+    connect(view, SIGNAL(selectionChanged(KTextEditor::View*)),
+            this, SLOT(scheduleBroadcast()));
+}
+
+void RemoteSelectionTracker::scheduleBroadcast()
+{
+    // Not restarted while running, so a continuously moving caret is sent every 100 ms.
+    if ( ! m_broadcastTimer.isActive() ) {
+        m_broadcastTimer.start();
+    }
+}
+
+void RemoteSelectionTracker::broadcastSelection()
+{
+    KTextEditor::View* view = m_document->document()->activeView();
+    Kobby::KDocumentTextBuffer* buffer = m_document->textBuffer();
+    if ( ! view || ! buffer || ! buffer->user() || ! m_document->isReady() || ! m_document->infTextDocument() ) {
+        return;
+    }
+    QPointer<QInfinity::TextSession> session = m_document->infTextDocument()->infSession();
+    if ( ! session || ! INF_TEXT_IS_USER(buffer->user()->gobject()) ) {
+        return;
+    }
+    const KTextEditor::Cursor cursor = view->cursorPosition();
+    const unsigned int position = buffer->cursorToOffset_kte(cursor);
+    int length = 0;
+    if ( view->selection() ) {
+        const KTextEditor::Range selection = view->selectionRange();
+        const KTextEditor::Cursor other = selection.start() == cursor ? selection.end() : selection.start();
+        length = static_cast<int>(buffer->cursorToOffset_kte(other)) - static_cast<int>(position);
+    }
+    InfTextUser* user = INF_TEXT_USER(buffer->user()->gobject());
+    if ( inf_text_user_get_caret_position(user) == position && inf_text_user_get_selection_length(user) == length ) {
+        // nothing new for the others
+        return;
+    }
+    inf_text_session_set_user_selection(INF_TEXT_SESSION(session->gobject()), user, position, length);
+}
+
+#include "remoteselectiontracker.moc"
@@ -0,0 +1,123 @@
+/*
+ * This file is part of kobby
+ * Copyright 2013  Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REMOTESELECTIONTRACKER_H
+#define REMOTESELECTIONTRACKER_H
+
+#include <QObject>
+#include <QHash>
+#include <QPointer>
+#include <QTimer>
+#include <QColor>
+
+#include <KTextEditor/Cursor>
+
+typedef struct _InfTextUser InfTextUser;
+
+namespace KTextEditor {
+    class Document;
+    class View;
+    class MovingCursor;
+    class MovingRange;
+}
+
+namespace QInfinity {
+    class User;
+    class QGSignal;
+}
+using QInfinity::User;
+
+class ManagedDocument;
+
+/**
+ * @brief Tracks the carets and selections of the users of a collaborative document.
+ *
+ * Remote selections are highlighted in the document directly; the carets are drawn
+ * by the RemoteChangeNotifier overlay of each view, which asks this class for them.
+ * Both are moved along by KatePart when the text changes, and are only updated
+ * from the session when the user actually moved the caret.
+ *
+ * The local user's caret and selection are sent to the other users, at most
+ * every 100 ms, and only if the session does not know them already (e.g. typing
+ * text moves the caret in the session as well).
+ */
+class RemoteSelectionTracker : public QObject {
+Q_OBJECT
+public:
+    RemoteSelectionTracker(ManagedDocument* const document);
+    virtual ~RemoteSelectionTracker();
+
+    struct Caret {
+        QString userName;
+        QColor color;
+        KTextEditor::Cursor position;
+    };
+    /**
+     * @brief The current carets of all remote users which are available
+     */
+    QList<Caret> carets() const;
+
+public slots:
+    /**
+     * @brief Starts tracking the users of the document's session, once it is ready.
+     */
+    void documentReady(ManagedDocument* document);
+
+    /**
+     * @brief Forgets about all users, e.g. because the session was lost.
+     */
+    void clear();
+
+signals:
+    /**
+     * @brief Emitted when a remote user's caret was moved, appeared or went away.
+     */
+    void caretsChanged();
+
+private slots:
+    void userAdded(User* user);
+    void userStatusChanged();
+    void viewCreated(KTextEditor::Document*, KTextEditor::View* view);
+    void scheduleBroadcast();
+    void broadcastSelection();
+
+private:
+    static void selectionChangedCb(InfTextUser* user, unsigned int position, int length,
+                                   int byRequest, void* tracker);
+    void trackUser(QInfinity::User* user);
+    void removeUser(unsigned int id);
+    void setSelection(unsigned int id, unsigned int position, int length);
+
+    struct RemoteUser {
+        QPointer<QInfinity::User> user;
+        QInfinity::QGSignal* selectionChanged;
+        KTextEditor::MovingCursor* caret;
+        KTextEditor::MovingRange* selection;
+    };
+
+    ManagedDocument* const m_document;
+    // Remote users with a known caret, by user id
+    QHash<unsigned int, RemoteUser> m_users;
+    QTimer m_broadcastTimer;
+};
+
+#endif // REMOTESELECTIONTRACKER_H
@@ -0,0 +1,281 @@
+/* This file is part of the Kobby plugin
+ * Copyright (C) 2013 Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "subscriptionscheduler.h"
+
+#include <libqinfinity/browser.h>
+#include <libqinfinity/explorerequest.h>
+
+#include <KDebug>
+
+#include <QDateTime>
+#include <QStringList>
+
+// How often a path which does not exist is looked up again before giving up
+static const int maxLookupFailures = 5;
+// Delay before the first fallback retry, in ms; doubled for each further failure
+static const int initialRetryDelay = 500;
+
+// Whether @p path is @p directory itself or somewhere below it; compares whole path components
+static bool isBelow(const QString& path, QString directory)
+{
+    while ( directory.endsWith('/') ) {
+        directory.chop(1);
+    }
+    return path == directory || path.startsWith(directory + '/');
+}
+
+SubscriptionScheduler::SubscriptionScheduler(QInfinity::Browser* browser, Connection* connection)
+    : QObject(browser)
+    , m_browser(browser)
+    , m_connection(connection)
+{
+    // Collect all lookups requested during one event loop iteration
+    m_batchTimer.setSingleShot(true);
+    m_batchTimer.setInterval(0);
+    connect(&m_batchTimer, SIGNAL(timeout()), this, SLOT(processBatch()));
+    m_retryTimer.setSingleShot(true);
+    connect(&m_retryTimer, SIGNAL(timeout()), this, SLOT(retryTimerExpired()));
+    connect(m_browser, SIGNAL(nodeAdded(BrowserIter)), this, SLOT(nodeAdded(BrowserIter)));
+    connect(m_connection, SIGNAL(statusChanged(Connection*,QInfinity::XmlConnection::Status)),
+            this, SLOT(connectionStatusChanged(Connection*,QInfinity::XmlConnection::Status)));
+}
+
+SubscriptionScheduler* SubscriptionScheduler::forBrowser(QInfinity::Browser* browser, Connection* connection)
+{
+    SubscriptionScheduler* scheduler = browser->findChild<SubscriptionScheduler*>();
+    if ( ! scheduler ) {
+        scheduler = new SubscriptionScheduler(browser, connection);
+    }
+    return scheduler;
+}
+
+void SubscriptionScheduler::connectionStatusChanged(Connection* , QInfinity::XmlConnection::Status status)
+{
+    if ( status != QInfinity::XmlConnection::Closed && status != QInfinity::XmlConnection::Open ) {
+        return;
+    }
+    kDebug() << "connection status changed to" << status << "restarting" << m_pending.size() << "lookups";
+    // Requests in flight when the connection went away will never finish;
+    // if they report anything, it is ignored.
+    m_exploring.clear();
+    m_retryTimer.stop();
+    for ( QHash<QString, PendingLookup>::iterator it = m_pending.begin(); it != m_pending.end(); ++it ) {
+        *it = PendingLookup();
+    }
+    if ( status == QInfinity::XmlConnection::Open && ! m_pending.isEmpty() ) {
+        m_batchTimer.start();
+    }
+    else {
+        m_batchTimer.stop();
+    }
+}
+
+void SubscriptionScheduler::lookup(const QString& path)
+{
+    if ( m_pending.contains(path) ) {
+        // Whoever asked before will get the result, too
+        kDebug() << "lookup for" << path << "is already pending";
+        return;
+    }
+    m_pending.insert(path, PendingLookup());
+    m_batchTimer.start();
+}
+
+void SubscriptionScheduler::cancel(const QString& path)
+{
+    if ( m_pending.remove(path) ) {
+        // The retry timer might only be running for this path
+        scheduleRetry();
+    }
+}
+
+void SubscriptionScheduler::setQueued(const QString& path)
+{
+    m_pending[path].state = Queued;
+    m_batchTimer.start();
+}
+
+void SubscriptionScheduler::processBatch()
+{
+    if ( ! m_connection || m_connection->status() != QInfinity::XmlConnection::Open ) {
+        // everything stays queued until the connection is open again
+        return;
+    }
+    foreach ( const QString& path, m_pending.keys() ) {
+        if ( ! m_pending.contains(path) || m_pending.value(path).state != Queued ) {
+            continue;
+        }
+        BrowserIter iter(*m_browser);
+        switch ( resolve(path, &iter) ) {
+            case Resolved:
+                m_pending.remove(path);
+                emit found(path, iter);
+                break;
+            case Waiting:
+                m_pending[path].state = Exploring;
+                break;
+            case NotFound:
+                lookupMissed(path);
+                break;
+        }
+    }
+}
+
+SubscriptionScheduler::Resolution SubscriptionScheduler::resolve(const QString& path, BrowserIter* result)
+{
+    BrowserIter iter(*m_browser);
+    foreach ( const QString& component, path.split('/', QString::SkipEmptyParts) ) {
+        if ( ! iter.isDirectory() ) {
+            return NotFound;
+        }
+        if ( ! iter.isExplored() ) {
+            exploreDirectory(iter);
+            return Waiting;
+        }
+        BrowserIter child(iter);
+        bool found = false;
+        if ( child.child() ) {
+            do {
+                if ( child.name() == component ) {
+                    found = true;
+                    break;
+                }
+            } while ( child.next() );
+        }
+        if ( ! found ) {
+            return NotFound;
+        }
+        iter = child;
+    }
+    *result = iter;
+    return Resolved;
+}
+
+void SubscriptionScheduler::exploreDirectory(BrowserIter directory)
+{
+    const QString path = directory.path();
+    if ( m_exploring.contains(path) ) {
+        return;
+    }
+    // Someone else might be exploring this directory already
+    ExploreRequest* request = directory.exploreRequest();
+    if ( ! request ) {
+        kDebug() << "exploring" << path;
+        request = directory.explore();
+    }
+    m_exploring.insert(path, request);
+    connect(request, SIGNAL(finished(ExploreRequest*)), this, SLOT(directoryExplored(ExploreRequest*)));
+    connect(request, SIGNAL(failed(GError*)), this, SLOT(exploreFailed(GError*)));
+}
+
+void SubscriptionScheduler::directoryExplored(ExploreRequest* request)
+{
+    if ( ! m_exploring.values().contains(request) ) {
+        // started before the connection was closed
+        return;
+    }
+    const QString directory = m_exploring.key(request);
+    m_exploring.remove(directory);
+    // Everything waiting for this directory can continue now
+    foreach ( const QString& path, m_pending.keys() ) {
+        if ( m_pending.value(path).state == Exploring && isBelow(path, directory) ) {
+            setQueued(path);
+        }
+    }
+}
+
+void SubscriptionScheduler::exploreFailed(GError* error)
+{
+    ExploreRequest* request = qobject_cast<ExploreRequest*>(sender());
+    if ( ! m_exploring.values().contains(request) ) {
+        return;
+    }
+    const QString directory = m_exploring.key(request);
+    kWarning() << "failed to explore" << directory << ( error ? error->message : "" );
+    m_exploring.remove(directory);
+    foreach ( const QString& path, m_pending.keys() ) {
+        if ( m_pending.value(path).state == Exploring && isBelow(path, directory) ) {
+            lookupMissed(path);
+        }
+    }
+}
+
+void SubscriptionScheduler::lookupMissed(const QString& path)
+{
+    PendingLookup& pending = m_pending[path];
+    pending.failures += 1;
+    if ( pending.failures > maxLookupFailures ) {
+        kDebug() << "giving up on" << path;
+        m_pending.remove(path);
+        emit failed(path);
+        return;
+    }
+    // The path will most likely appear through nodeAdded(); the timer is only a fallback.
+    kDebug() << path << "not found, waiting for it to appear";
+    pending.state = Missing;
+    pending.retryAt = QDateTime::currentMSecsSinceEpoch() + ( initialRetryDelay << (pending.failures - 1) );
+    scheduleRetry();
+}
+
+void SubscriptionScheduler::nodeAdded(BrowserIter iter)
+{
+    const QString added = iter.path();
+    foreach ( const QString& path, m_pending.keys() ) {
+        if ( m_pending.value(path).state != Missing ) {
+            continue;
+        }
+        // Either the document itself or one of the directories leading to it was added
+        if ( isBelow(path, added) ) {
+            kDebug() << "node" << added << "appeared, looking up" << path << "again";
+            setQueued(path);
+        }
+    }
+}
+
+void SubscriptionScheduler::retryTimerExpired()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    foreach ( const QString& path, m_pending.keys() ) {
+        const PendingLookup pending = m_pending.value(path);
+        if ( pending.state == Missing && pending.retryAt <= now ) {
+            setQueued(path);
+        }
+    }
+    scheduleRetry();
+}
+
+void SubscriptionScheduler::scheduleRetry()
+{
+    qint64 next = -1;
+    foreach ( const PendingLookup& pending, m_pending ) {
+        if ( pending.state == Missing && ( next == -1 || pending.retryAt < next ) ) {
+            next = pending.retryAt;
+        }
+    }
+    if ( next == -1 ) {
+        m_retryTimer.stop();
+        return;
+    }
+    m_retryTimer.start(qMax<qint64>(0, next - QDateTime::currentMSecsSinceEpoch()));
+}
+
+#include "subscriptionscheduler.moc"
@@ -0,0 +1,160 @@
+/* This file is part of the Kobby plugin
+ * Copyright (C) 2013 Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SUBSCRIPTIONSCHEDULER_H
+#define SUBSCRIPTIONSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QPointer>
+#include <QTimer>
+
+#include <libqinfinity/browseriter.h>
+#include <libqinfinity/xmlconnection.h>
+
+#include "common/connection.h"
+
+typedef struct _GError GError;
+
+namespace QInfinity {
+    class Browser;
+    class ExploreRequest;
+}
+
+using QInfinity::BrowserIter;
+using QInfinity::ExploreRequest;
+using Kobby::Connection;
+
+/**
+ * @brief Finds the browser iters for documents which should be subscribed.
+ * There is one instance per browser, get it with forBrowser().
+ *
+ * Lookups requested during one iteration of the event loop are resolved
+ * together: each directory on the way is explored only once, no matter how
+ * many documents are below it, and all documents waiting for a directory are
+ * resolved as soon as its contents arrived. Lookups for the same path are
+ * only done once at a time.
+ *
+ * If a path does not exist (yet), the scheduler waits for the browser to report
+ * a node which leads to the path, and looks it up again immediately when that
+ * happens. Lookups are only repeated on a timer with exponential backoff as a
+ * fallback, in case no such node shows up.
+ *
+ * When the connection is closed, explorations in progress are forgotten; all
+ * pending lookups are started from scratch once it is open again.
+ */
+class SubscriptionScheduler : public QObject {
+Q_OBJECT
+public:
+    /**
+     * @brief Get the scheduler for the given browser, creating it if necessary.
+     * The scheduler is owned by the browser.
+     * @param connection The connection the browser uses
+     */
+    static SubscriptionScheduler* forBrowser(QInfinity::Browser* browser, Connection* connection);
+
+    /**
+     * @brief Find the iter for the given path.
+     * Either found() or failed() will be emitted for the path later.
+     * @param path absolute path of the document on the server, without trailing slash
+     */
+    void lookup(const QString& path);
+
+    /**
+     * @brief Stop looking for the given path. No signal will be emitted for it.
+     */
+    void cancel(const QString& path);
+
+signals:
+    /**
+     * @brief Emitted when the iter for a path which was looked up was found.
+     */
+    void found(const QString& path, QInfinity::BrowserIter iter);
+    /**
+     * @brief Emitted when a path could not be found after waiting for it for a while.
+     */
+    void failed(const QString& path);
+
+private slots:
+    /**
+     * @brief Resolve all lookups which are ready to be resolved.
+     */
+    void processBatch();
+    void directoryExplored(ExploreRequest* request);
+    void exploreFailed(GError* error);
+    void nodeAdded(BrowserIter iter);
+    void retryTimerExpired();
+    /**
+     * @brief Restart all pending lookups when the connection was closed or opened again.
+     */
+    void connectionStatusChanged(Connection* connection, QInfinity::XmlConnection::Status status);
+
+private:
+    SubscriptionScheduler(QInfinity::Browser* browser, Connection* connection);
+
+    enum LookupState {
+        // should be resolved in the next batch
+        Queued,
+        // waiting for a directory on the way to be explored
+        Exploring,
+        // the path doesn't exist, waiting for it to appear
+        Missing
+    };
+
+    struct PendingLookup {
+        PendingLookup()
+            : state(Queued)
+            , failures(0)
+            , retryAt(0) { };
+        LookupState state;
+        // how often the path was not found so far
+        int failures;
+        // when to try again even if no matching node was added, in ms since the epoch
+        qint64 retryAt;
+    };
+
+    enum Resolution {
+        Resolved,
+        Waiting,
+        NotFound
+    };
+
+    /**
+     * @brief Walk the already explored part of the tree towards path.
+     * If a directory on the way is not explored yet, exploring it is started.
+     * @param result set to the iter for path if it was found
+     */
+    Resolution resolve(const QString& path, BrowserIter* result);
+    void exploreDirectory(BrowserIter directory);
+    void setQueued(const QString& path);
+    void lookupMissed(const QString& path);
+    void scheduleRetry();
+
+    QInfinity::Browser* m_browser;
+    QPointer<Connection> m_connection;
+    QHash<QString, PendingLookup> m_pending;
+    // Directories being explored, by path
+    QHash<QString, ExploreRequest*> m_exploring;
+    QTimer m_batchTimer;
+    QTimer m_retryTimer;
+};
+
+#endif
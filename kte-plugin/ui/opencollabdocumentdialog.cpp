@@ -98,8 +98,8 @@ OpenCollabDocumentDialog::OpenCollabDocumentDialog(QWidget* parent, Qt::WindowFl
     widget->layout()->addWidget(m_manualSelectionWidget);
     widget->layout()->addWidget(existingGroup);
 
-    connect(connections, SIGNAL(connectionClicked(uint,QString)),
-            this, SLOT(connectionClicked(uint,QString)));
+    connect(connections, SIGNAL(connectionClicked(uint,QString,QString)),
+            this, SLOT(connectionClicked(uint,QString,QString)));
 
     connect(button(KDialog::Ok), SIGNAL(clicked(bool)), SLOT(acceptedWithManualConnection()));
 
@@ -122,9 +122,10 @@ void HostSelectionWidget::showAdvanced(bool)
     m_advancedSettingsLayout->addRow(new QLabel(i18n("Password (optional):")), m_password);
 }
 
-void OpenCollabDocumentDialog::connectionClicked(uint port, QString user)
+void OpenCollabDocumentDialog::connectionClicked(uint port, QString user, QString rootDirectory)
 {
     m_selectedConnection = qMakePair(port, user);
+    m_selectedRootDirectory = rootDirectory;
     accept();
     requestFileToOpen();
 }
@@ -165,6 +166,9 @@ KUrl OpenCollabDocumentDialog::selectedBaseUrl() const
         url.setHost("127.0.0.1");
         url.setPort(m_selectedConnection.first);
         url.setUser(m_selectedConnection.second);
+        if ( ! m_selectedRootDirectory.isEmpty() ) {
+            url.setPath(m_selectedRootDirectory);
+        }
     }
     else {
         // read parameters from manual selection
@@ -64,7 +64,7 @@ signals:
     void shouldOpenDocument(const KUrl&);
 
 public slots:
-    void connectionClicked(uint,QString);
+    void connectionClicked(uint,QString,QString);
     void acceptedWithManualConnection();
 
 private slots:
@@ -72,6 +72,7 @@ private slots:
 
 private:
     QPair<unsigned int, QString> m_selectedConnection;
+    QString m_selectedRootDirectory;
     HostSelectionWidget* m_manualSelectionWidget;
 };
 
@@ -45,11 +45,20 @@ Rectangle {
         text: "<no text>"
     }
 
+    Text {
+        objectName: "details"
+        color: "#AAAAAA"
+        horizontalAlignment: Text.AlignHCenter
+        anchors.centerIn: parent
+        anchors.verticalCenterOffset: 15
+        text: syncProgress.details
+    }
+
     ListView {
         z: 2
         id: pbar
         objectName: "progressBar"
-        property double progress: 0.0
+        property double progress: syncProgress.fraction
         anchors.centerIn: parent
         rotation: 270
         model: 12
@@ -22,6 +22,7 @@
 #include "remotechangenotifier.h"
 
 #include "ktecollaborativepluginview.h"
+#include "remoteselectiontracker.h"
 #include "common/utils.h"
 
 #include <libqinfinity/user.h>
@@ -32,30 +33,152 @@
 #include <QGraphicsItem>
 #include <QtDeclarative/QDeclarativeView>
 #include <QtDeclarative/QDeclarativeContext>
-#include <QPaintEvent>
-#include <QLabel>
+#include <QtDeclarative/QDeclarativeComponent>
+#include <QtDeclarative/QDeclarativeItem>
+#include <QResizeEvent>
+#include <QSet>
 #include <QTimer>
 
-QMap< QPair<KTextEditor::View*, QString>, QWidget* > RemoteChangeNotifier::existingWidgets;
+QMap<KTextEditor::View*, RemoteChangeNotifier*> RemoteChangeNotifier::s_notifiers;
 
-NotifierWidget::NotifierWidget(const QUrl& source, QWidget* parent)
-    : QDeclarativeView(source, parent)
-    , m_closeTimer(new QTimer(parent))
+// How many labels may exist in one view at a time
+static const int maxLabelsPerView = 5;
+
+NotifierLabel::NotifierLabel(QDeclarativeItem* item, QObject* parent)
+    : QObject(parent)
+    , m_item(item)
+    , m_closeTimer(new QTimer(this))
     , m_forceUpdate(false)
+    , m_hideAnimation(item->findChild<QObject*>("hideAnimation"))
 {
     m_closeTimer->setSingleShot(true);
     m_closeTimer->setInterval(3000);
     connect(m_closeTimer, SIGNAL(timeout()), this, SLOT(hide()));
+    m_item->setVisible(false);
+}
+
+NotifierLabel::~NotifierLabel()
+{
+    delete m_item;
+}
+
+bool NotifierLabel::isVisible() const
+{
+    return m_item->isVisible();
+}
+
+void NotifierLabel::hide()
+{
+    m_item->setVisible(false);
+    emit hidden();
+}
+
+void NotifierLabel::setUser(const QString& userName, const QColor& color)
+{
+    if ( userName != m_userName ) {
+        m_userName = userName;
+        m_item->setProperty("username", userName);
+    }
+    if ( color != m_color ) {
+        m_color = color;
+        m_item->setProperty("widgetcolor", color.name());
+        m_item->setProperty("brightness", 1 - ColorHelper::y(color) / 255.0);
+    }
+}
+
+void NotifierLabel::restart()
+{
+    // restart animation
+    QMetaObject::invokeMethod(m_hideAnimation, "restart");
+    startCloseTimer();
+    // reset label opacity + position
+    QMetaObject::invokeMethod(m_item, "reset");
+}
+
+RemoteChangeNotifier::RemoteChangeNotifier(KTextEditor::View* view)
+    : QDeclarativeView(qmlSource("notifyoverlay.qml"), view)
+    , m_view(view)
+    , m_labelComponent(new QDeclarativeComponent(engine(), qmlSource("notifywidget.qml"), this))
+    , m_caretComponent(new QDeclarativeComponent(engine(), this))
+{
+    m_caretComponent->setData("import QtQuick 1.1\nRectangle { width: 2 }", QUrl());
+    // this is for getting a transparent overlay, which does not take away clicks from the view
+    QPalette p = palette();
+    p.setColor( QPalette::Window, Qt::transparent );
+    setPalette( p );
+    setBackgroundRole( QPalette::Window );
+    setBackgroundBrush(QBrush(QColor(0, 0, 0, 0)));
+    setAutoFillBackground( true );
+    setFrameStyle(QFrame::NoFrame);
+    setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setAttribute(Qt::WA_TransparentForMouseEvents);
+    setFocusPolicy(Qt::NoFocus);
+
+    m_moveTimer.setSingleShot(true);
+    m_moveTimer.setInterval(16);
+    connect(&m_moveTimer, SIGNAL(timeout()), this, SLOT(moveWidgets()));
+    // update the positions when the user scrolls
+    connect(view, SIGNAL(verticalScrollPositionChanged(KTextEditor::View*,KTextEditor::Cursor)),
+            this, SLOT(scheduleMove()));
+    connect(view, SIGNAL(horizontalScrollPositionChanged(KTextEditor::View*)),
+            this, SLOT(scheduleMove()));
+    view->installEventFilter(this);
+    resizeToView();
+    // only shown while there are visible labels
+    hide();
+}
+
+RemoteChangeNotifier::~RemoteChangeNotifier()
+{
+    s_notifiers.remove(m_view);
+    // the items belong to the scene, delete them before it goes away
+    qDeleteAll(m_labels);
+    qDeleteAll(m_carets);
+}
+
+RemoteChangeNotifier* RemoteChangeNotifier::forView(KTextEditor::View* view, bool create)
+{
+    RemoteChangeNotifier* notifier = s_notifiers.value(view);
+    if ( ! notifier && create ) {
+        // deleted together with the view
+        notifier = new RemoteChangeNotifier(view);
+        if ( ! notifier->rootObject() || ! notifier->m_labelComponent->isReady() ) {
+            kWarning() << "Errors occurred while loading the notification overlay:"
+                       << notifier->m_labelComponent->errors();
+            delete notifier;
+            return 0;
+        }
+        s_notifiers.insert(view, notifier);
+    }
+    return notifier;
+}
+
+QUrl RemoteChangeNotifier::qmlSource(const QString& fileName)
+{
+    static QMap<QString, QUrl> sources;
+    if ( ! sources.contains(fileName) ) {
+        sources[fileName] = QUrl(KStandardDirs::locate("data", "ktecollaborative/ui/" + fileName));
+    }
+    return sources[fileName];
+}
+
+void RemoteChangeNotifier::resizeToView()
+{
+    resize(m_view->size());
+    setSceneRect(QRectF(QPointF(0, 0), m_view->size()));
+    if ( QDeclarativeItem* root = qobject_cast<QDeclarativeItem*>(rootObject()) ) {
+        root->setSize(m_view->size());
+    }
 }
 
-bool NotifierWidget::event(QEvent* event)
+bool RemoteChangeNotifier::eventFilter(QObject* watched, QEvent* e)
 {
-    if ( event->type() == QEvent::MouseButtonPress ) {
-        hide();
-        event->ignore();
-        return false;
+    if ( watched == m_view && e->type() == QEvent::Resize ) {
+        resizeToView();
+        scheduleMove();
     }
-    return QGraphicsView::event(event);
+    return QDeclarativeView::eventFilter(watched, e);
 }
 
 void RemoteChangeNotifier::addNotificationWidget(KTextEditor::View* view, KTextEditor::Cursor cursor,
@@ -64,101 +187,203 @@ void RemoteChangeNotifier::addNotificationWidget(KTextEditor::View* view, KTextE
     if ( ! view ) {
         return;
     }
-    QWidget* useWidget = 0;
-    KStandardDirs d;
-    QUrl src = QUrl(d.locate("data", "ktecollaborative/ui/notifywidget.qml"));
-
-    QPair< KTextEditor::View*, QString > key = QPair<KTextEditor::View*, QString>(view, user->name());
-    if ( existingWidgets.contains(key) ) {
-        // move an existing widget
-        useWidget = existingWidgets[key];
-    }
-    if ( ! useWidget ) {
-        // create a new widget
-        // this is for getting semi-transparent widgets
-        // load the QML file which draws the user label
-        QDeclarativeView* widget = new NotifierWidget(src, view);
-        QPalette p = widget->palette();
-        p.setColor( QPalette::Window, Qt::transparent );
-        widget->setPalette( p );
-        widget->setBackgroundRole( QPalette::Window );
-        widget->setBackgroundBrush(QBrush(QColor(0, 0, 0, 0)));
-        widget->setAutoFillBackground( true );
-
-        // check if loading the QML file was successful, otherwise abort
-        if ( ! widget->rootContext() ) {
-            kWarning() << "Errors occurred while loading" << src;
+    RemoteChangeNotifier* notifier = forView(view, true);
+    if ( ! notifier ) {
+        return;
+    }
+    NotifierLabel* label = notifier->labelForUser(user->name());
+    if ( ! label ) {
+        return;
+    }
+    // the label is not needed any more once the user leaves
+    connect(user, SIGNAL(statusChanged()), notifier, SLOT(userStatusChanged()), Qt::UniqueConnection);
+
+    label->setUser(user->name(), color);
+    label->restart();
+    label->setCursorPosition(cursor);
+    label->forceUpdate();
+    // moving and showing the label is done with the next frame
+    notifier->scheduleMove();
+}
+
+void RemoteChangeNotifier::showRemoteCarets(KTextEditor::View* view, RemoteSelectionTracker* tracker)
+{
+    RemoteChangeNotifier* notifier = forView(view, true);
+    if ( ! notifier || notifier->m_selectionTracker == tracker ) {
+        return;
+    }
+    if ( notifier->m_selectionTracker ) {
+        notifier->m_selectionTracker->disconnect(notifier);
+    }
+    notifier->m_selectionTracker = tracker;
+    connect(tracker, SIGNAL(caretsChanged()), notifier, SLOT(scheduleMove()));
+    // the carets move along with the text
+    connect(view->document(), SIGNAL(textChanged(KTextEditor::Document*)),
+            notifier, SLOT(scheduleMove()), Qt::UniqueConnection);
+    notifier->scheduleMove();
+}
+
+void RemoteChangeNotifier::removeNotificationWidget(KTextEditor::View* view, const QString& userName)
+{
+    if ( RemoteChangeNotifier* notifier = forView(view, false) ) {
+        notifier->removeLabel(userName);
+    }
+}
+
+NotifierLabel* RemoteChangeNotifier::labelForUser(const QString& userName)
+{
+    for ( int i = 0; i < m_labels.size(); i++ ) {
+        if ( m_labels.at(i)->userName() == userName ) {
+            // move an existing label; it is now the most recently used one
+            NotifierLabel* label = m_labels.takeAt(i);
+            m_labels.append(label);
+            return label;
+        }
+    }
+    if ( m_labels.size() >= maxLabelsPerView ) {
+        // take over the label which was used least recently
+        NotifierLabel* label = m_labels.takeFirst();
+        m_labels.append(label);
+        return label;
+    }
+
+    // create a new label item in the overlay's scene
+    QDeclarativeItem* item = qobject_cast<QDeclarativeItem*>(m_labelComponent->create(rootContext()));
+    if ( ! item ) {
+        kWarning() << "Errors occurred while creating a notification label:" << m_labelComponent->errors();
+        return 0;
+    }
+    item->setParentItem(qobject_cast<QDeclarativeItem*>(rootObject()));
+    NotifierLabel* label = new NotifierLabel(item, this);
+    connect(label, SIGNAL(hidden()), this, SLOT(scheduleMove()));
+    m_labels.append(label);
+    return label;
+}
+
+void RemoteChangeNotifier::removeLabel(const QString& userName)
+{
+    for ( int i = 0; i < m_labels.size(); i++ ) {
+        if ( m_labels.at(i)->userName() == userName ) {
+            delete m_labels.takeAt(i);
+            scheduleMove();
             return;
         }
+    }
+}
 
-        useWidget = widget;
-        existingWidgets[key] = widget;
+void RemoteChangeNotifier::userStatusChanged()
+{
+    const QInfinity::User* user = qobject_cast<QInfinity::User*>(sender());
+    if ( user && user->status() == QInfinity::User::Unavailable ) {
+        removeLabel(user->name());
     }
+}
 
-    NotifierWidget* notifierWidget = static_cast<NotifierWidget*>(useWidget);
-    notifierWidget->rootObject()->setProperty("username", user->name());
-    notifierWidget->rootObject()->setProperty("widgetcolor", color.name());
-    notifierWidget->rootObject()->setProperty("brightness", 1 - ColorHelper::y(color) / 255.0);
-    QObject* hideAnimation = notifierWidget->rootObject()->findChild<QObject*>("hideAnimation");
-    // restart animation
-    QMetaObject::invokeMethod(hideAnimation, "restart");
-    notifierWidget->startCloseTimer();
+void RemoteChangeNotifier::scheduleMove()
+{
+    if ( ! m_moveTimer.isActive() ) {
+        m_moveTimer.start();
+    }
+}
 
-    // update the position now, and when the user scrolls
-    QObject::connect(view, SIGNAL(verticalScrollPositionChanged(KTextEditor::View*,KTextEditor::Cursor)),
-                     notifierWidget, SLOT(moveWidget(KTextEditor::View*)), Qt::UniqueConnection);
-    QObject::connect(view, SIGNAL(horizontalScrollPositionChanged(KTextEditor::View*)),
-                     notifierWidget, SLOT(moveWidget(KTextEditor::View*)), Qt::UniqueConnection);
-    notifierWidget->setCursorPosition(cursor);
-    notifierWidget->forceUpdate();
-    notifierWidget->moveWidget(view);
-    // reset widget opacity + position
-    QMetaObject::invokeMethod(notifierWidget->rootObject(), "reset");
-    notifierWidget->show();
+void RemoteChangeNotifier::moveWidgets()
+{
+    bool anyVisible = moveCarets();
+    foreach ( NotifierLabel* label, m_labels ) {
+        label->moveLabel(m_view, this);
+        anyVisible = anyVisible || label->isVisible();
+    }
+    // Nothing needs to be composited over the view if no label is displayed.
+    setVisible(anyVisible);
+    if ( anyVisible ) {
+        raise();
+    }
 }
 
-void NotifierWidget::startCloseTimer()
+bool RemoteChangeNotifier::moveCarets()
+{
+    QList<RemoteSelectionTracker::Caret> carets;
+    if ( m_selectionTracker ) {
+        carets = m_selectionTracker->carets();
+    }
+    QSet<QString> unused = QSet<QString>::fromList(m_carets.keys());
+    bool anyVisible = false;
+    foreach ( const RemoteSelectionTracker::Caret& caret, carets ) {
+        unused.remove(caret.userName);
+        QDeclarativeItem* item = m_carets.value(caret.userName);
+        if ( ! item ) {
+            item = qobject_cast<QDeclarativeItem*>(m_caretComponent->create(rootContext()));
+            if ( ! item ) {
+                kWarning() << "Errors occurred while creating a caret:" << m_caretComponent->errors();
+                return anyVisible;
+            }
+            item->setParentItem(qobject_cast<QDeclarativeItem*>(rootObject()));
+            m_carets.insert(caret.userName, item);
+        }
+        if ( item->property("color").value<QColor>() != caret.color ) {
+            item->setProperty("color", caret.color);
+        }
+        const QPoint pos = m_view->cursorToCoordinate(caret.position);
+        if ( pos == QPoint(-1, -1) ) {
+            // above or below the view
+            item->setVisible(false);
+            continue;
+        }
+        item->setPos(pos);
+        item->setHeight(m_view->fontMetrics().height());
+        item->setVisible(true);
+        anyVisible = true;
+    }
+    foreach ( const QString& userName, unused ) {
+        delete m_carets.take(userName);
+    }
+    return anyVisible;
+}
+
+void NotifierLabel::startCloseTimer()
 {
     m_closeTimer->start();
 }
 
-void NotifierWidget::moveWidget(KTextEditor::View* view)
+void NotifierLabel::moveLabel(KTextEditor::View* view, QWidget* overlay)
 {
     if ( ! m_forceUpdate && ! isVisible() ) {
         return;
     }
-    // use KTE api to calculate position
+    if ( m_forceUpdate ) {
+        // the label was requested for a new change
+        m_forceUpdate = false;
+        m_item->setVisible(true);
+    }
+    // use KTE api to calculate position; the overlay covers the view exactly,
+    // so view coordinates are scene coordinates.
     const QPoint rawPos = view->cursorToCoordinate(m_position);
     if ( rawPos == QPoint(-1, -1) ) {
         // position is above or below the view
-        rootObject()->setProperty("outsideView", true);
+        m_item->setProperty("outsideView", true);
         if ( KTextEditor::CoordinatesToCursorInterface* iface = qobject_cast<KTextEditor::CoordinatesToCursorInterface*>(view)) {
             const KTextEditor::Cursor topLeft = iface->coordinatesToCursor(QPoint(0, 0));
             if ( topLeft.line() < m_position.line() ) {
                 // position is below the view
-                int bottom = view->height() - height();
+                qreal bottom = overlay->height() - m_item->height();
                 if ( QWidget* statusBar = view->findChild<CollaborativeStatusBar*>() ) {
                     bottom -= statusBar->height();
                 }
-                move(0, bottom);
+                m_item->setPos(0, bottom);
             }
             else {
                 // position is above the view
-                move(0, 0);
+                m_item->setPos(0, 0);
             }
         }
         else {
-            // interface is not supported; just hide the widget
-            hide();
+            // interface is not supported; just hide the label
+            m_item->setVisible(false);
             return;
         }
     }
     else {
-        rootObject()->setProperty("outsideView", false);
-        QPoint pos = mapToParent(rawPos);
-        pos.setY(pos.y() + view->fontMetrics().height()*0.8 - y());
-        pos.setX(pos.x() - 15 - x());
-        QPoint pos2 = mapToParent(pos);
-        move(qMax(10, pos2.x() - x()), pos2.y() - y());
+        m_item->setProperty("outsideView", false);
+        m_item->setPos(qMax(10, rawPos.x() - 15), rawPos.y() + view->fontMetrics().height()*0.8);
     }
 }
@@ -24,6 +24,8 @@
 
 #include <QObject>
 #include <QTimer>
+#include <QPointer>
+#include <QHash>
 #include <QDeclarativeView>
 #include <KTextEditor/View>
 
@@ -31,37 +33,99 @@ namespace QInfinity {
     class User;
 }
 
-// This class is used to draw fancy widgets in the editor window when a
-// remote user changes text
-class RemoteChangeNotifier : public QObject
+class QDeclarativeComponent;
+class QDeclarativeItem;
+class NotifierLabel;
+class RemoteSelectionTracker;
+
+// This class is used to draw fancy labels in the editor window when a
+// remote user changes text.
+// There is one instance per view: a transparent overlay covering the view, which
+// draws the labels of all users in a single scene. It keeps a small pool of labels;
+// when more users are writing at the same time, the label which was used least recently is taken over.
+// It also draws the carets of the remote users, as given by a RemoteSelectionTracker.
+class RemoteChangeNotifier : public QDeclarativeView
 {
+Q_OBJECT
 public:
     static void addNotificationWidget(KTextEditor::View* view, KTextEditor::Cursor cursor,
                                       const QInfinity::User* user, const QColor& color);
-    // TODO do those use enough memory to be worth freeing temporarily? Each one might eventually be re-used
-    // if the user writes more text, so it's not really a leak.
-    static QMap< QPair<KTextEditor::View*, QString>, QWidget* > existingWidgets;
+    // Removes the label for the given user from the view, e.g. because the user left
+    static void removeNotificationWidget(KTextEditor::View* view, const QString& userName);
+    // Draws the remote carets known to @p tracker in the view, until the view goes away
+    static void showRemoteCarets(KTextEditor::View* view, RemoteSelectionTracker* tracker);
+    virtual ~RemoteChangeNotifier();
+    // Tracks the size of the view
+    virtual bool eventFilter(QObject* watched, QEvent* e);
+
+private slots:
+    // The labels are laid out at most once per frame, no matter how often this is called
+    void scheduleMove();
+    void moveWidgets();
+    void userStatusChanged();
+
+private:
+    RemoteChangeNotifier(KTextEditor::View* view);
+    static RemoteChangeNotifier* forView(KTextEditor::View* view, bool create);
+    // The location of a QML file, which is only looked up once
+    static QUrl qmlSource(const QString& fileName);
+    NotifierLabel* labelForUser(const QString& userName);
+    void removeLabel(const QString& userName);
+    void resizeToView();
+    // Returns true if any caret is visible
+    bool moveCarets();
+
+    static QMap<KTextEditor::View*, RemoteChangeNotifier*> s_notifiers;
+    KTextEditor::View* m_view;
+    // Creates the label items; the QML file is only compiled once
+    QDeclarativeComponent* m_labelComponent;
+    // The labels of this view, the least recently used one first
+    QList<NotifierLabel*> m_labels;
+    QTimer m_moveTimer;
+
+    QPointer<RemoteSelectionTracker> m_selectionTracker;
+    QDeclarativeComponent* m_caretComponent;
+    // The caret items, by user name
+    QHash<QString, QDeclarativeItem*> m_carets;
 };
 
-class NotifierWidget : public QDeclarativeView {
+// One user's label in the overlay
+class NotifierLabel : public QObject {
 Q_OBJECT
 public:
-    NotifierWidget(const QUrl& source, QWidget* parent = 0);
+    NotifierLabel(QDeclarativeItem* item, QObject* parent);
+    virtual ~NotifierLabel();
     void startCloseTimer();
-    virtual bool event(QEvent* event);
     inline void setCursorPosition(KTextEditor::Cursor& cursor) {
         m_position = cursor;
     };
     inline void forceUpdate() {
         m_forceUpdate = true;
     };
+    inline const QString& userName() const {
+        return m_userName;
+    };
+    bool isVisible() const;
+    // Sets the name and color to display; the QML item is only touched if they changed.
+    void setUser(const QString& userName, const QColor& color);
+    // Shows the label again for a new change, and restarts the timer hiding it.
+    void restart();
+    // Moves the label to the position of its cursor in @p view, which is covered by @p overlay
+    void moveLabel(KTextEditor::View* view, QWidget* overlay);
+
+signals:
+    void hidden();
 
-public slots:
-    void moveWidget(KTextEditor::View* view);
+private slots:
+    void hide();
 
 private:
+    QDeclarativeItem* m_item;
     QTimer* m_closeTimer;
     bool m_forceUpdate;
     KTextEditor::Cursor m_position;
+    QString m_userName;
+    QColor m_color;
+    QObject* m_hideAnimation;
 };
 #endif // REMOTECHANGENOTIFIER_H
@@ -90,8 +90,8 @@ ShareDocumentDialog::ShareDocumentDialog(KTextEditor::View* activeView)
     connect(shareContactButton, SIGNAL(clicked(bool)), SLOT(shareWithContact()));
     connect(shareChatRoomButton, SIGNAL(clicked(bool)), SLOT(shareWithChatRoom()));
     connect(shareExistingServerButton, SIGNAL(clicked(bool)), SLOT(putOnExistingServer()));
-    connect(connections, SIGNAL(connectionClicked(uint,QString)),
-            this, SLOT(shareWithExistingConnection(uint,QString)));
+    connect(connections, SIGNAL(connectionClicked(uint,QString,QString)),
+            this, SLOT(shareWithExistingConnection(uint,QString,QString)));
 
     resize(600, 450);
 
@@ -111,7 +111,7 @@ void ShareDocumentDialog::jobFinished(KJob* job)
     emit shouldOpenDocument(copyJob->destUrl());
 }
 
-void ShareDocumentDialog::shareWithExistingConnection(uint port, QString nickname)
+void ShareDocumentDialog::shareWithExistingConnection(uint port, QString nickname, QString rootDirectory)
 {
     kDebug() << "share with existing connection clicked";
     KUrl dest;
@@ -119,7 +119,7 @@ void ShareDocumentDialog::shareWithExistingConnection(uint port, QString nicknam
     dest.setHost("127.0.0.1");
     dest.setPort(port);
     dest.setUser(nickname);
-    dest.setFileName(m_view->document()->url().fileName());
+    dest.setPath(InfTubeBase::tubePath(rootDirectory, m_view->document()->url().fileName()));
     KIO::FileCopyJob* job = KIO::file_copy(m_view->document()->url(), dest, -1, KIO::HideProgressInfo);
     connect(job, SIGNAL(finished(KJob*)), SLOT(jobFinished(KJob*)));
 }
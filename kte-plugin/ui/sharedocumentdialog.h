@@ -43,7 +43,7 @@ public:
 private slots:
     void shareWithContact();
     void shareWithChatRoom();
-    void shareWithExistingConnection(uint, QString);
+    void shareWithExistingConnection(uint, QString, QString);
     void jobFinished(KJob* job);
     void putOnExistingServer();
 
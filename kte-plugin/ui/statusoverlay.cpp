@@ -20,6 +20,7 @@
  */
 #include "statusoverlay.h"
 #include "version.h"
+#include "manageddocument.h"
 
 #include <libqinfinity/session.h>
 
@@ -30,10 +31,82 @@
 #include <KLocalizedString>
 #include <qdeclarativeerror.h>
 #include <qdeclarativeitem.h>
+#include <qdeclarativecontext.h>
 
-StatusOverlay::StatusOverlay(KTextEditor::View* parent)
-    : QDeclarativeView(QUrl(KStandardDirs().locate("data", "ktecollaborative/ui/overlay.qml")), parent)
+SynchronizationProgress::SynchronizationProgress(QObject* parent)
+    : QObject(parent)
+    , m_dirty(false)
+    , m_fraction(0.0)
+    , m_characters(0)
+    , m_operations(0)
+    , m_secondsRemaining(-1)
+{
+}
+
+void SynchronizationProgress::update(double fraction, int characters, int operations)
+{
+    if ( ! m_elapsed.isValid() ) {
+        m_elapsed.start();
+    }
+    m_fraction = fraction;
+    m_characters = characters;
+    m_operations = operations;
+    m_dirty = true;
+}
+
+void SynchronizationProgress::publish()
+{
+    if ( ! m_dirty ) {
+        return;
+    }
+    m_dirty = false;
+    // Too early for a sensible guess otherwise
+    const qint64 elapsed = m_elapsed.elapsed();
+    if ( m_fraction > 0.02 && elapsed > 500 ) {
+        m_secondsRemaining = qRound(elapsed * ( 1.0 - m_fraction ) / m_fraction / 1000.0);
+    }
+    emit changed();
+}
+
+double SynchronizationProgress::fraction() const
+{
+    return m_fraction;
+}
+
+int SynchronizationProgress::characters() const
+{
+    return m_characters;
+}
+
+int SynchronizationProgress::operations() const
+{
+    return m_operations;
+}
+
+int SynchronizationProgress::secondsRemaining() const
+{
+    return m_secondsRemaining;
+}
+
+QString SynchronizationProgress::details() const
+{
+    if ( m_operations == 0 ) {
+        return QString();
+    }
+    const QString received = i18ncp("%2 is a number of characters", "%2 characters in 1 operation",
+                                    "%2 characters in %1 operations", m_operations, m_characters);
+    if ( m_secondsRemaining < 0 ) {
+        return received;
+    }
+    return i18nc("%1 is e.g. \"100 characters in 3 operations\"", "%1, about %2 left", received,
+                 i18np("1 second", "%1 seconds", m_secondsRemaining));
+}
+
+StatusOverlay::StatusOverlay(KTextEditor::View* parent, ManagedDocument* document)
+    : QDeclarativeView(parent)
     , m_view(parent)
+    , m_document(document)
+    , m_progress(new SynchronizationProgress(this))
 {
     QPalette p = palette();
     p.setColor(QPalette::Window, Qt::transparent);
@@ -41,10 +114,15 @@ StatusOverlay::StatusOverlay(KTextEditor::View* parent)
     setBackgroundRole(QPalette::Window);
     setBackgroundBrush(QBrush(QColor(0, 0, 0, 0)));
     setAutoFillBackground(true);
+    // must be known before the QML file is loaded, it binds to it
+    rootContext()->setContextProperty("syncProgress", m_progress);
+    setSource(QUrl(KStandardDirs::locate("data", "ktecollaborative/ui/overlay.qml")));
     if ( ! rootObject() ) {
         kWarning() << "error creating overlay";
         return;
     }
+    m_textItem = rootObject()->findChild<QObject*>("text");
+    m_progressBarItem = rootObject()->findChild<QObject*>("progressBar");
     kDebug() << "view size:" << m_view->size();
     m_view->installEventFilter(this);
     resizeToView();
@@ -55,30 +133,44 @@ StatusOverlay::StatusOverlay(KTextEditor::View* parent)
                             QString(KTECOLLAB_VERSION_STRING)) + "<br>" +
                        i18n("using libinfinity version %1", QString(LIBINFINITY_VERSION));
     textWidget->setProperty("text", subtitle);
-    m_maxUpdateRateTimer.start();
+
+    m_displayTimer.setSingleShot(true);
+    m_displayTimer.setInterval(100);
+    connect(&m_displayTimer, SIGNAL(timeout()), this, SLOT(updateDisplay()));
 }
 
 void StatusOverlay::progress(double percentage)
 {
-    if ( m_maxUpdateRateTimer.elapsed() > 100 ) {
-        setProgressBar(percentage);
-        displayText(i18nc("%1 is a progress percentage", "Synchronizing document... %1%", static_cast<int>(percentage*100)));
-        repaint();
-        m_maxUpdateRateTimer.restart();
+    int characters = 0;
+    int operations = 0;
+    if ( m_document && m_document->textBuffer() ) {
+        characters = m_document->textBuffer()->remoteCharacterCount();
+        operations = m_document->textBuffer()->remoteOperationCount();
+    }
+    m_progress->update(percentage, characters, operations);
+    if ( ! m_displayTimer.isActive() ) {
+        m_displayTimer.start();
     }
 }
 
+void StatusOverlay::updateDisplay()
+{
+    m_progress->publish();
+    displayText(i18nc("%1 is a progress percentage", "Synchronizing document... %1%",
+                      static_cast<int>(m_progress->fraction()*100)));
+}
+
 void StatusOverlay::setProgressBar(double percentage)
 {
-    if ( ! rootObject() ) return;
-    QObject* progressbar = rootObject()->findChild<QObject*>("progressBar");
-    progressbar->setProperty("progress", percentage);
+    if ( ! m_progressBarItem ) return;
+    m_progressBarItem->setProperty("progress", percentage);
 }
 
 void StatusOverlay::loadStateChanged(Document* , Document::LoadState state)
 {
     if ( ! rootObject() ) return;
     if ( state == Document::Joining ) {
+        m_displayTimer.stop();
         setProgressBar(1.0);
         displayText(i18n("Joining session..."));
     }
@@ -102,11 +194,9 @@ void StatusOverlay::connectionStatusChanged(Connection* , QInfinity::XmlConnecti
 
 void StatusOverlay::displayText(const QString& text)
 {
-    if ( ! rootObject() ) return;
-    QObject* textWidget = rootObject()->findChild<QObject*>("text");
-    textWidget->setProperty("text", text);
+    if ( ! m_textItem ) return;
+    m_textItem->setProperty("text", text);
 }
-
 void StatusOverlay::resizeToView()
 {
     resize(m_view->width(), m_view->height());
@@ -23,6 +23,9 @@
 #define STATUSOVERLAY_H
 
 #include <QDeclarativeView>
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QTimer>
 #include <libqinfinity/xmlconnection.h>
 
 #include "common/document.h"
@@ -36,6 +39,58 @@ namespace KTextEditor {
 using Kobby::Document;
 using Kobby::Connection;
 
+class ManagedDocument;
+
+/**
+ * @brief The progress of synchronizing a document, as displayed by the StatusOverlay.
+ *
+ * The overlay's QML binds to the properties of this object. update() is cheap and may
+ * be called for every synchronization step; the new values are only published (and
+ * the bindings re-evaluated) when publish() is called, which happens at display rate.
+ */
+class SynchronizationProgress : public QObject
+{
+Q_OBJECT
+Q_PROPERTY(double fraction READ fraction NOTIFY changed)
+Q_PROPERTY(int characters READ characters NOTIFY changed)
+Q_PROPERTY(int operations READ operations NOTIFY changed)
+Q_PROPERTY(int secondsRemaining READ secondsRemaining NOTIFY changed)
+Q_PROPERTY(QString details READ details NOTIFY changed)
+public:
+    explicit SynchronizationProgress(QObject* parent = 0);
+
+    /**
+     * @brief Records the current state.
+     * @param fraction 0.0 to 1.0
+     * @param characters characters received so far
+     * @param operations operations received so far
+     */
+    void update(double fraction, int characters, int operations);
+    /**
+     * @brief Emits changed() if update() was called since the last time.
+     */
+    void publish();
+
+    double fraction() const;
+    int characters() const;
+    int operations() const;
+    /// Estimated time until synchronization is done, -1 if unknown yet
+    int secondsRemaining() const;
+    /// A human-readable summary of the above
+    QString details() const;
+
+signals:
+    void changed();
+
+private:
+    QElapsedTimer m_elapsed;
+    bool m_dirty;
+    double m_fraction;
+    int m_characters;
+    int m_operations;
+    int m_secondsRemaining;
+};
+
 /**
  * @brief This class provides the overlay which is displayed when a document is loading.
  */
@@ -46,7 +101,7 @@ public:
     /**
      * @brief Constructs a new overlay, but does not show it. Size of the given @p parent is tracked.
      */
-    explicit StatusOverlay(KTextEditor::View* parent);
+    StatusOverlay(KTextEditor::View* parent, ManagedDocument* document);
 
     /**
      * @brief Event filter for tracking the parent's size
@@ -67,6 +122,12 @@ public slots:
     void loadStateChanged(Document*,Document::LoadState);
     void connectionStatusChanged(Connection*,QInfinity::XmlConnection::Status);
 
+private slots:
+    /**
+     * @brief Publishes the progress collected since the last call.
+     */
+    void updateDisplay();
+
 private:
     /**
      * @brief Resizes the overlay to the parent view's size
@@ -80,9 +141,15 @@ private:
 
 private:
     KTextEditor::View* m_view;
-    /// Timer to prevent too frequent updates. On my machine, a redraw takes about
-    /// 5ms, so make sure we don't repaint more than 10 times a second in any case.
-    QTime m_maxUpdateRateTimer;
+    ManagedDocument* m_document;
+    SynchronizationProgress* m_progress;
+    /// Items of the QML file, looked up once
+    QPointer<QObject> m_textItem;
+    QPointer<QObject> m_progressBarItem;
+    /// Progress is published with this timer, so the display is updated at most
+    /// ten times a second, no matter how many synchronization steps happen in between.
+    /// The painting itself is scheduled by the QML scene; it's never forced.
+    QTimer m_displayTimer;
 };
 
 #endif // STATUSOVERLAY_H
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2013 Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "userslistpopup.h"
+#include "usersmodel.h"
+
+#include <KLineEdit>
+#include <KLocalizedString>
+
+#include <QListView>
+#include <QComboBox>
+#include <QBoxLayout>
+#include <QApplication>
+#include <QDesktopWidget>
+
+UsersListPopup::UsersListPopup(UsersModel* model, QWidget* parent)
+    : QFrame(parent, Qt::Popup)
+    , m_filterModel(new UsersFilterModel(this))
+    , m_list(new QListView)
+    , m_filter(new QComboBox)
+    , m_search(new KLineEdit)
+{
+    setAttribute(Qt::WA_DeleteOnClose);
+    setFrameStyle(QFrame::StyledPanel | QFrame::Raised);
+    m_filterModel->setSourceModel(model);
+
+    m_filter->addItem(i18n("All users"), UsersFilterModel::AllUsers);
+    m_filter->addItem(i18n("Online users"), UsersFilterModel::OnlineUsers);
+    m_filter->addItem(i18n("Active users"), UsersFilterModel::ActiveUsers);
+    m_filter->addItem(i18n("Users who wrote text"), UsersFilterModel::Authors);
+    connect(m_filter, SIGNAL(currentIndexChanged(int)), this, SLOT(filterChanged(int)));
+
+    m_search->setClearButtonShown(true);
+    m_search->setClickMessage(i18n("Search users"));
+    connect(m_search, SIGNAL(textChanged(QString)), m_filterModel, SLOT(setFilterFixedString(QString)));
+
+    // All rows have the same height, so the view does not need to look at rows which are not visible;
+    // they are laid out in batches while scrolling.
+    m_list->setUniformItemSizes(true);
+    m_list->setLayoutMode(QListView::Batched);
+    m_list->setBatchSize(50);
+    m_list->setSelectionMode(QAbstractItemView::NoSelection);
+    m_list->setModel(m_filterModel);
+
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    QHBoxLayout* filterLayout = new QHBoxLayout;
+    filterLayout->addWidget(m_search);
+    filterLayout->addWidget(m_filter);
+    layout->addLayout(filterLayout);
+    layout->addWidget(m_list);
+    resize(320, 360);
+}
+
+void UsersListPopup::filterChanged(int index)
+{
+    m_filterModel->setFilter(static_cast<UsersFilterModel::Filter>(m_filter->itemData(index).toInt()));
+}
+
+void UsersListPopup::showAbove(QWidget* widget)
+{
+    QPoint pos = widget->mapToGlobal(QPoint(0, -height()));
+    const QRect screen = QApplication::desktop()->availableGeometry(widget);
+    pos.setX(qBound(screen.left(), pos.x(), screen.right() - width()));
+    pos.setY(qMax(screen.top(), pos.y()));
+    move(pos);
+    show();
+    m_search->setFocus();
+}
+
+#include "userslistpopup.moc"
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2013 Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef USERSLISTPOPUP_H
+#define USERSLISTPOPUP_H
+
+#include <QFrame>
+
+class UsersModel;
+class UsersFilterModel;
+class QListView;
+class QComboBox;
+class KLineEdit;
+
+/**
+ * @brief A popup listing all users of a document, with a filter by state and by name.
+ * The list view only creates and paints the rows which are visible, so this works
+ * for sessions with hundreds of users, unlike the labels in the status bar.
+ */
+class UsersListPopup : public QFrame
+{
+Q_OBJECT
+public:
+    explicit UsersListPopup(UsersModel* model, QWidget* parent = 0);
+
+    /**
+     * @brief Shows the popup above @p widget, e.g. the button which opened it.
+     */
+    void showAbove(QWidget* widget);
+
+private slots:
+    void filterChanged(int index);
+
+private:
+    UsersFilterModel* m_filterModel;
+    QListView* m_list;
+    QComboBox* m_filter;
+    KLineEdit* m_search;
+};
+
+#endif // USERSLISTPOPUP_H
@@ -0,0 +1,237 @@
+/*
+ * This file is part of kobby
+ * Copyright 2013  Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "usersmodel.h"
+#include "manageddocument.h"
+#include "documentchangetracker.h"
+
+#include <libqinfinity/user.h>
+#include <libqinfinity/usertable.h>
+
+UsersModel::UsersModel(ManagedDocument* const document)
+    : QAbstractListModel(document)
+    , m_document(document)
+{
+    connect(m_document, SIGNAL(documentReady(ManagedDocument*)),
+            this, SLOT(resetUserTable()));
+    connect(m_document->changeTracker(), SIGNAL(colorTableChanged()),
+            this, SLOT(colorTableChanged()));
+}
+
+bool UsersModel::isListed(const User* user) const
+{
+    // TODO urgh
+    return user && user->name() != QLatin1String("Initial document contents");
+}
+
+void UsersModel::resetUserTable()
+{
+    QInfinity::UserTable* table = m_document->userTable();
+    beginResetModel();
+    if ( m_userTable ) {
+        m_userTable->disconnect(this);
+    }
+    foreach ( const QPointer<User>& user, m_users ) {
+        if ( user ) {
+            user->disconnect(this);
+        }
+    }
+    m_users.clear();
+    m_userTable = table;
+    m_contributors = m_document->changeTracker()->usedColors();
+    if ( table ) {
+        foreach ( const QPointer<User>& user, table->users() ) {
+            if ( isListed(user) ) {
+                connect(user.data(), SIGNAL(statusChanged()), this, SLOT(userStatusChanged()));
+                m_users << user;
+            }
+        }
+        connect(table, SIGNAL(userAdded(User*)), this, SLOT(userAdded(User*)));
+        connect(table, SIGNAL(userRemoved(User*)), this, SLOT(userRemoved(User*)));
+    }
+    endResetModel();
+}
+
+int UsersModel::rowCount(const QModelIndex& parent) const
+{
+    if ( parent.isValid() ) {
+        return 0;
+    }
+    return m_users.size();
+}
+
+User* UsersModel::userAt(int row) const
+{
+    if ( row < 0 || row >= m_users.size() ) {
+        return 0;
+    }
+    return m_users.at(row).data();
+}
+
+int UsersModel::rowForUser(const User* user) const
+{
+    for ( int i = 0; i < m_users.size(); i++ ) {
+        if ( m_users.at(i).data() == user ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+QVariant UsersModel::data(const QModelIndex& index, int role) const
+{
+    const User* user = userAt(index.row());
+    if ( ! user ) {
+        return QVariant();
+    }
+    switch ( role ) {
+        case Qt::DisplayRole:
+        case Qt::ToolTipRole:
+        case UserNameRole:
+            return user->name();
+        case StatusRole:
+            return static_cast<int>(user->status());
+        case OnlineRole:
+            return user->status() == QInfinity::User::Active;
+        case Qt::DecorationRole:
+            if ( m_contributors.contains(user->name()) ) {
+                return m_contributors.value(user->name());
+            }
+            return QVariant();
+        case ContributedRole:
+            return m_contributors.contains(user->name());
+        case LocalUserRole: {
+            const User* localUser = m_document->textBuffer() ? m_document->textBuffer()->user() : 0;
+            return localUser && localUser->id() == user->id();
+        }
+    }
+    return QVariant();
+}
+
+void UsersModel::userAdded(User* user)
+{
+    if ( ! isListed(user) || rowForUser(user) != -1 ) {
+        return;
+    }
+    beginInsertRows(QModelIndex(), m_users.size(), m_users.size());
+    connect(user, SIGNAL(statusChanged()), this, SLOT(userStatusChanged()));
+    m_users << user;
+    endInsertRows();
+}
+
+void UsersModel::userRemoved(User* user)
+{
+    const int row = rowForUser(user);
+    if ( row == -1 ) {
+        return;
+    }
+    beginRemoveRows(QModelIndex(), row, row);
+    user->disconnect(this);
+    m_users.removeAt(row);
+    endRemoveRows();
+}
+
+void UsersModel::userStatusChanged()
+{
+    const int row = rowForUser(qobject_cast<User*>(sender()));
+    if ( row != -1 ) {
+        emit dataChanged(index(row), index(row));
+    }
+}
+
+void UsersModel::colorTableChanged()
+{
+    const QMap<QString, QColor> previous = m_contributors;
+    m_contributors = m_document->changeTracker()->usedColors();
+    for ( int i = 0; i < m_users.size(); i++ ) {
+        if ( ! m_users.at(i) ) {
+            continue;
+        }
+        const QString& name = m_users.at(i)->name();
+        if ( previous.contains(name) != m_contributors.contains(name)
+             || previous.value(name) != m_contributors.value(name) )
+        {
+            emit dataChanged(index(i), index(i));
+        }
+    }
+}
+
+UsersFilterModel::UsersFilterModel(QObject* parent)
+    : QSortFilterProxyModel(parent)
+    , m_filter(AllUsers)
+{
+    setFilterCaseSensitivity(Qt::CaseInsensitive);
+    setFilterRole(UsersModel::UserNameRole);
+    setSortCaseSensitivity(Qt::CaseInsensitive);
+    setDynamicSortFilter(true);
+    sort(0);
+}
+
+void UsersFilterModel::setFilter(Filter filter)
+{
+    if ( filter != m_filter ) {
+        m_filter = filter;
+        invalidateFilter();
+    }
+}
+
+UsersFilterModel::Filter UsersFilterModel::filter() const
+{
+    return m_filter;
+}
+
+bool UsersFilterModel::filterAcceptsRow(int sourceRow, const QModelIndex& sourceParent) const
+{
+    const QModelIndex index = sourceModel()->index(sourceRow, 0, sourceParent);
+    switch ( m_filter ) {
+        case OnlineUsers:
+            if ( index.data(UsersModel::StatusRole).toInt() == QInfinity::User::Unavailable ) {
+                return false;
+            }
+            break;
+        case ActiveUsers:
+            if ( ! index.data(UsersModel::OnlineRole).toBool() ) {
+                return false;
+            }
+            break;
+        case Authors:
+            if ( ! index.data(UsersModel::ContributedRole).toBool() ) {
+                return false;
+            }
+            break;
+        case AllUsers:
+            break;
+    }
+    return QSortFilterProxyModel::filterAcceptsRow(sourceRow, sourceParent);
+}
+
+bool UsersFilterModel::lessThan(const QModelIndex& left, const QModelIndex& right) const
+{
+    const bool leftOnline = left.data(UsersModel::OnlineRole).toBool();
+    if ( leftOnline != right.data(UsersModel::OnlineRole).toBool() ) {
+        return leftOnline;
+    }
+    return QString::localeAwareCompare(left.data(UsersModel::UserNameRole).toString(),
+                                       right.data(UsersModel::UserNameRole).toString()) < 0;
+}
+
+#include "usersmodel.moc"
@@ -0,0 +1,124 @@
+/*
+ * This file is part of kobby
+ * Copyright 2013  Sven Brauch <svenbrauch@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef USERSMODEL_H
+#define USERSMODEL_H
+
+#include <QAbstractListModel>
+#include <QSortFilterProxyModel>
+#include <QPointer>
+#include <QMap>
+#include <QColor>
+
+namespace QInfinity {
+    class User;
+    class UserTable;
+}
+using QInfinity::User;
+
+class ManagedDocument;
+
+/**
+ * @brief A list model of the users of a document's session.
+ *
+ * The model follows the session's user table and the document's change tracker,
+ * and only announces what actually changed (a user joined, a user's status changed, ...),
+ * so views can update single rows instead of rebuilding everything.
+ */
+class UsersModel : public QAbstractListModel {
+Q_OBJECT
+public:
+    enum Roles {
+        UserNameRole = Qt::UserRole + 1,
+        /// QInfinity::User::Status of the user
+        StatusRole,
+        /// true if the user's status is Active
+        OnlineRole,
+        /// true if the user wrote some of the text
+        ContributedRole,
+        /// true for the local user
+        LocalUserRole
+    };
+
+    UsersModel(ManagedDocument* const document);
+
+    virtual int rowCount(const QModelIndex& parent = QModelIndex()) const;
+    /// The decoration is the user's highlight color, if he wrote some text
+    virtual QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+
+    /**
+     * @brief Returns the user displayed in @p row, or 0 if it's gone.
+     */
+    User* userAt(int row) const;
+
+public slots:
+    /**
+     * @brief Displays the users of the document's current user table, e.g. after (re-)joining.
+     */
+    void resetUserTable();
+
+private slots:
+    void userAdded(User* user);
+    void userRemoved(User* user);
+    void userStatusChanged();
+    void colorTableChanged();
+
+private:
+    int rowForUser(const User* user) const;
+    bool isListed(const User* user) const;
+
+    ManagedDocument* const m_document;
+    QPointer<QInfinity::UserTable> m_userTable;
+    QList< QPointer<User> > m_users;
+    // Colors of the users which contributed text, as of the last colorTableChanged()
+    QMap<QString, QColor> m_contributors;
+};
+
+/**
+ * @brief Filters a UsersModel by the users' state and by name, and sorts online users first.
+ */
+class UsersFilterModel : public QSortFilterProxyModel {
+Q_OBJECT
+public:
+    enum Filter {
+        AllUsers,
+        /// Users whose status is not Unavailable
+        OnlineUsers,
+        /// Users whose status is Active
+        ActiveUsers,
+        /// Users who wrote some of the text
+        Authors
+    };
+
+    UsersFilterModel(QObject* parent = 0);
+    void setFilter(Filter filter);
+    Filter filter() const;
+
+protected:
+    virtual bool filterAcceptsRow(int sourceRow, const QModelIndex& sourceParent) const;
+    virtual bool lessThan(const QModelIndex& left, const QModelIndex& right) const;
+
+private:
+    Filter m_filter;
+};
+
+#endif // USERSMODEL_H
@@ -35,6 +35,7 @@
 #include <QDebug>
 #include <QSharedPointer>
 #include <QApplication>
+#include <QtDBus/QDBusConnection>
 
 #include <kdirnotify.h>
 #include <KDE/KUrl>
@@ -64,6 +65,11 @@ int main(int argc, char **argv) {
 
 namespace Kobby {
 
+// How long a connection which was only opened for listing directories is kept open after
+// the last listing, in ms. The kioslave lists through the notifier while browsing, which
+// should not need to reconnect for every directory.
+static const int listingIdleTimeout = 5 * 60 * 1000;
+
 Host hostForUrl(const KUrl& url) {
     return Host(url.host(), url.port());
 }
@@ -77,6 +83,9 @@ InfinoteNotifier::InfinoteNotifier(QObject* parent)
     QInfinity::init();
     connect(m_notifyIface, SIGNAL(enteredDirectory(QString)), SLOT(enteredDirectory(QString)));
     connect(m_notifyIface, SIGNAL(leftDirectory(QString)), SLOT(leftDirectory(QString)));
+    QDBusConnection::sessionBus().registerObject("/Browser", this, QDBusConnection::ExportScriptableSlots);
+    m_idleTimer.setInterval(60 * 1000);
+    connect(&m_idleTimer, SIGNAL(timeout()), SLOT(closeIdleConnections()));
 }
 
 InfinoteNotifier::~InfinoteNotifier()
@@ -121,29 +130,39 @@ void InfinoteNotifier::ensureInWatchlist(const QString& url_)
     if ( m_watchedUrls.contains(url) ) {
         return;
     }
+    m_watchedUrls.insert(url);
+    const Host host = hostForUrl(url);
+    if ( ! ensureConnection(host) ) {
+        // The directory is explored in connectionEstablished()
+        return;
+    }
+    kDebug() << "exploring" << url.url();
+    IterLookupHelper* helper = new IterLookupHelper(url.path(), m_hostBrowserMap[host]);
+    helper->setDeleteOnFinish();
+    helper->setExploreResult();
+    helper->begin();
+}
+
+bool InfinoteNotifier::ensureConnection(const Host& host)
+{
+    cleanupConnectionList();
+
     if ( ! m_browserModel ) {
         m_browserModel = QSharedPointer<QInfinity::BrowserModel>(new QInfinity::BrowserModel(this));
         m_browserModel->setItemFactory(new Kobby::ItemFactory(this));
     }
-    m_watchedUrls.insert(url);
-    Host host(url.host(), url.port());
-    bool haveConnectionForHost = m_connectionHostMap.values().contains(host);
-    if ( haveConnectionForHost ) {
-        kDebug() << "exploring" << url.url();
-        IterLookupHelper* helper = new IterLookupHelper(url.path(), m_hostBrowserMap[host]);
-        helper->setDeleteOnFinish();
-        helper->setExploreResult();
-        helper->begin();
-        return;
+    if ( m_connectionHostMap.values().contains(host) ) {
+        return true;
     }
     // We do not handle errors here at all. If the connection fails, it'll not be watched.
-    kDebug() << "creating connection for" << url;
+    kDebug() << "creating connection for" << host.hostname << host.port;
     Kobby::Connection* conn = new Kobby::Connection(host.hostname, host.port, QString(), this);
     QObject::connect(conn, SIGNAL(ready(Connection*)), this, SLOT(connectionReady(Connection*)));
     QObject::connect(conn, SIGNAL(error(Connection*,QString)), SLOT(connectionError(Connection*,QString)));
     QObject::connect(conn, SIGNAL(disconnecting(Connection*)), SLOT(connectionDisconnected(Connection*)));
     QObject::connect(conn, SIGNAL(disconnected(Connection*)), SLOT(connectionDisconnected(Connection*)));
     conn->prepare();
+    return false;
 }
 
 void InfinoteNotifier::connectionDisconnected(Connection* connection)
@@ -162,15 +181,17 @@ void InfinoteNotifier::connectionDisconnected(Connection* connection)
             m_watchedUrls.remove(url);
         }
     }
+    failPendingListings(host, i18n("The connection to the server was lost."));
     m_browserModel->removeRows(item->index().row(), 1, QModelIndex());
     m_hostBrowserMap.take(host);
     m_connectionHostMap.take(item);
     m_connectionItemMap.take(connection->xmppConnection());
 }
 
-void InfinoteNotifier::connectionError(Connection* , QString error)
+void InfinoteNotifier::connectionError(Connection* connection, QString error)
 {
     kDebug() << "connection error:" << error;
+    failPendingListings(connection->host(), error);
 }
 
 void InfinoteNotifier::connectionReady(Connection* conn)
@@ -204,6 +225,7 @@ void InfinoteNotifier::connectionReady(Connection* conn)
 
 void InfinoteNotifier::connectionEstablished(const QInfinity::Browser* browser)
 {
+    startPendingListings();
     // Ensure all wateched directories are explored
     foreach ( const KUrl& watched, m_watchedUrls ) {
         const Host host = hostForUrl(watched);
@@ -218,6 +240,146 @@ void InfinoteNotifier::connectionEstablished(const QInfinity::Browser* browser)
     }
 }
 
+QStringList InfinoteNotifier::listDirectory(const QString& url)
+{
+    kDebug() << "listing requested for" << url;
+    PendingListing listing;
+    listing.url = KUrl(url);
+    listing.message = message();
+    setDelayedReply(true);
+    m_waitingListings << listing;
+    // Only connect; the directory is not watched, nobody would tell when to stop watching it.
+    const Host host = hostForUrl(listing.url);
+    ensureConnection(host);
+    m_lastListing[host].start();
+    if ( ! m_idleTimer.isActive() ) {
+        m_idleTimer.start();
+    }
+    startPendingListings();
+    return QStringList();
+}
+
+void InfinoteNotifier::startPendingListings()
+{
+    const QList<PendingListing> waiting = m_waitingListings;
+    m_waitingListings.clear();
+    foreach ( const PendingListing& listing, waiting ) {
+        QInfinity::Browser* browser = m_hostBrowserMap.value(hostForUrl(listing.url));
+        if ( ! browser || browser->connectionStatus() != INF_BROWSER_OPEN ) {
+            m_waitingListings << listing;
+            continue;
+        }
+        IterLookupHelper* helper = new IterLookupHelper(listing.url.path(KUrl::AddTrailingSlash), browser);
+        helper->setDeleteOnFinish();
+        connect(helper, SIGNAL(done(QInfinity::BrowserIter)), this, SLOT(listingLookupDone(QInfinity::BrowserIter)));
+        connect(helper, SIGNAL(failed()), this, SLOT(listingLookupFailed()));
+        m_runningListings.insert(helper, listing);
+        helper->beginLater();
+    }
+}
+
+void InfinoteNotifier::failPendingListings(const Host& host, const QString& message)
+{
+    QList<PendingListing> failed;
+    QList<PendingListing>::iterator waiting = m_waitingListings.begin();
+    while ( waiting != m_waitingListings.end() ) {
+        if ( hostForUrl(waiting->url) == host ) {
+            failed << *waiting;
+            waiting = m_waitingListings.erase(waiting);
+        }
+        else {
+            ++waiting;
+        }
+    }
+    QHash<IterLookupHelper*, PendingListing>::iterator running = m_runningListings.begin();
+    while ( running != m_runningListings.end() ) {
+        if ( hostForUrl(running->url) == host ) {
+            failed << *running;
+            running.key()->deleteLater();
+            running = m_runningListings.erase(running);
+        }
+        else {
+            ++running;
+        }
+    }
+    foreach ( const PendingListing& listing, failed ) {
+        QDBusConnection::sessionBus().send(listing.message.createErrorReply(QDBusError::Failed, message));
+    }
+}
+
+bool InfinoteNotifier::hasPendingListings(const Host& host) const
+{
+    foreach ( const PendingListing& listing, m_waitingListings ) {
+        if ( hostForUrl(listing.url) == host ) {
+            return true;
+        }
+    }
+    foreach ( const PendingListing& listing, m_runningListings ) {
+        if ( hostForUrl(listing.url) == host ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void InfinoteNotifier::closeIdleConnections()
+{
+    foreach ( const Host& host, m_lastListing.keys() ) {
+        if ( m_lastListing.value(host).elapsed() < listingIdleTimeout || hasPendingListings(host) ) {
+            continue;
+        }
+        m_lastListing.remove(host);
+        bool watched = false;
+        foreach ( const KUrl& url, m_watchedUrls ) {
+            watched = watched || hostForUrl(url) == host;
+        }
+        QInfinity::Browser* browser = m_hostBrowserMap.value(host);
+        if ( watched || ! browser || ! browser->connection() ) {
+            // Still needed for notifications, or gone already
+            continue;
+        }
+        kDebug() << "closing connection to" << host.hostname << host.port << "which was only used for listing";
+        // Cleaning up happens in connectionDisconnected()
+        browser->connection()->close();
+    }
+    if ( m_lastListing.isEmpty() ) {
+        m_idleTimer.stop();
+    }
+}
+
+void InfinoteNotifier::listingLookupDone(QInfinity::BrowserIter iter)
+{
+    IterLookupHelper* helper = qobject_cast<IterLookupHelper*>(sender());
+    if ( ! m_runningListings.contains(helper) ) {
+        return;
+    }
+    const PendingListing listing = m_runningListings.take(helper);
+    if ( ! iter.isDirectory() ) {
+        QDBusConnection::sessionBus().send(listing.message.createErrorReply(QDBusError::InvalidArgs,
+                                           i18n("%1 is not a directory.", listing.url.url())));
+        return;
+    }
+    QStringList entries;
+    if ( iter.child() ) {
+        do {
+            entries << ( iter.isDirectory() ? iter.name() + '/' : iter.name() );
+        } while ( iter.next() );
+    }
+    kDebug() << "listed" << listing.url << ":" << entries.size() << "entries";
+    QDBusConnection::sessionBus().send(listing.message.createReply(entries));
+}
+
+void InfinoteNotifier::listingLookupFailed()
+{
+    IterLookupHelper* helper = qobject_cast<IterLookupHelper*>(sender());
+    if ( ! m_runningListings.contains(helper) ) {
+        return;
+    }
+    const PendingListing listing = m_runningListings.take(helper);
+    QDBusConnection::sessionBus().send(listing.message.createErrorReply(QDBusError::InvalidArgs,
+                                       i18n("%1 does not exist.", listing.url.url())));
+}
+
 void InfinoteNotifier::handleItemChanged(BrowserIter iter, bool removal)
 {
     QInfinity::BrowserIter copy(iter);
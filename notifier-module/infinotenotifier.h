@@ -23,8 +23,12 @@
 #define INFINOTENOTIFIER_H
 
 #include <QtDBus/QDBusContext>
+#include <QtDBus/QDBusMessage>
 #include <QSet>
+#include <QTimer>
+#include <QTime>
 #include <QSharedPointer>
+#include <KUrl>
 
 #include <common/connection.h>
 
@@ -37,8 +41,8 @@ namespace QInfinity {
     class BrowserIter;
     class Browser;
 }
-class KUrl;
 class OrgKdeKDirNotifyInterface;
+class IterLookupHelper;
 
 using Kobby::Connection;
 using Kobby::Host;
@@ -82,15 +86,28 @@ signals:
  * KDirNotify interface when a file is added or removed in such a directory.
  * As a secondary task, it can also display popup notifications for the user, to tell that
  * someone has shared a new file.
+ * Since it keeps connections to the servers open anyway, it also offers listing directories
+ * over D-Bus (on /Browser), so the kioslave does not need to connect to the server itself
+ * for browsing.
  */
-class InfinoteNotifier : public QObject
+class InfinoteNotifier : public QObject, protected QDBusContext
 {
 Q_OBJECT
+Q_CLASSINFO("D-Bus Interface", "org.kde.infinotenotifier.Browser")
 
 public:
     InfinoteNotifier(QObject *parent = 0);
     virtual ~InfinoteNotifier();
 
+public slots:
+    /**
+     * @brief List the contents of the directory @p url, called over D-Bus.
+     * The reply is sent once the directory was explored, using the notifier's
+     * connection to the server (which is established if necessary).
+     * @return one entry per item, directories have a trailing slash
+     */
+    Q_SCRIPTABLE QStringList listDirectory(const QString& url);
+
 private slots:
     /// Slots invoked when another application (e.g. dolphin) enters or leaves a directory
     void enteredDirectory(QString);
@@ -111,11 +128,20 @@ private slots:
     /// Called when the button in one of the popup messages is clicked
     void messageActionActivated();
 
+    /// Called when the directory for a listDirectory() call was found and explored
+    void listingLookupDone(QInfinity::BrowserIter);
+    void listingLookupFailed();
+    /// Close connections which were only opened for listDirectory() calls and are not used anymore
+    void closeIdleConnections();
+
 private:
     /// Ensures @p url is in the list of watched URLs.
     /// Items are only removed from the watchlist when a connection breaks, since
     /// establishing the connection is the most costly thing.
     void ensureInWatchlist(const QString& url);
+    /// Ensures there is a connection to @p host, establishing it if necessary.
+    /// @returns true if the connection existed already
+    bool ensureConnection(const Host& host);
 
     /// Clean all connections from the connections list which are broken,
     /// and remove the watched URLs for those
@@ -126,6 +152,13 @@ private:
     /// called by the itemAdded() / itemRemoved() handlers
     void handleItemChanged(BrowserIter, bool removal=false);
 
+    /// Start the lookups for all waiting listDirectory() calls whose connection is open
+    void startPendingListings();
+    /// Reply with an error to all waiting listDirectory() calls for @p host
+    void failPendingListings(const Host& host, const QString& message);
+    /// Whether listDirectory() calls for @p host are waiting for their reply
+    bool hasPendingListings(const Host& host) const;
+
 private:
     OrgKdeKDirNotifyInterface* m_notifyIface;
     /// List of watched URLs to receive notifications via KDirNotify
@@ -144,6 +177,21 @@ private:
     friend struct QueuedNotificationSet;
     /// Set of notifications to be displayed when they time out
     QueuedNotificationSet m_notifyQueue;
+
+    /// A listDirectory() call waiting for its reply
+    struct PendingListing {
+        KUrl url;
+        QDBusMessage message;
+    };
+    /// listDirectory() calls waiting for their connection to be established
+    QList<PendingListing> m_waitingListings;
+    /// listDirectory() calls waiting for the directory to be explored
+    QHash<IterLookupHelper*, PendingListing> m_runningListings;
+    /// Since when no listDirectory() call was made for each host. Unlike watched directories,
+    /// listings don't keep the connection to the host open once they are answered.
+    QHash<Host, QTime> m_lastListing;
+    /// Checks for connections which were only used for listings, see closeIdleConnections()
+    QTimer m_idleTimer;
 };
 
 }
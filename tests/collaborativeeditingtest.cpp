@@ -504,5 +504,129 @@ void CollaborativeEditingTest::testBasicCorrectness_data()
                                   << "3456789";
 }
 
+void CollaborativeEditingTest::testOfflineEditLog()
+{
+    QFETCH(QString, baseText);
+    QFETCH(OfflineEditLog::Operations, localOperations);
+    QFETCH(QString, serverText);
+    QFETCH(QString, expectedText);
+
+    OfflineEditLog log(baseText);
+    QString localText = baseText;
+    foreach ( const OfflineEditLog::Operation& op, localOperations ) {
+        if ( op.type == OfflineEditLog::Operation::Insert ) {
+            log.recordInsert(op.offset, op.text);
+        }
+        else {
+            log.recordErase(op.offset, op.erasedLength);
+        }
+        localText = OfflineEditLog::apply(localText, OfflineEditLog::Operations() << op);
+    }
+    QCOMPARE(log.localText(), localText);
+    QCOMPARE(OfflineEditLog::apply(serverText, log.rebase(serverText)), expectedText);
+}
+
+void CollaborativeEditingTest::testOfflineEditLog_data()
+{
+    typedef OfflineEditLog::Operation Op;
+    QTest::addColumn<QString>("baseText");
+    QTest::addColumn<OfflineEditLog::Operations>("localOperations");
+    QTest::addColumn<QString>("serverText");
+    QTest::addColumn<QString>("expectedText");
+
+    QTest::newRow("server_unchanged") << "Hello World" << ( OfflineEditLog::Operations() << Op::insert(5, ",") )
+                                      << "Hello World" << "Hello, World";
+    QTest::newRow("typing_merged") << "ab" << ( OfflineEditLog::Operations() << Op::insert(1, "x") << Op::insert(2, "y")
+                                                                             << Op::erase(2, 1) << Op::erase(1, 1) )
+                                   << "ab" << "ab";
+    QTest::newRow("remote_before") << "0123456789" << ( OfflineEditLog::Operations() << Op::insert(8, "X") )
+                                   << "AB0123456789" << "AB01234567X89";
+    QTest::newRow("remote_after") << "0123456789" << ( OfflineEditLog::Operations() << Op::erase(1, 2) )
+                                  << "012345678" << "0345678";
+    QTest::newRow("same_position") << "0123" << ( OfflineEditLog::Operations() << Op::insert(2, "local") )
+                                   << "01remote23" << "01remotelocal23";
+    QTest::newRow("insert_in_removed") << "0123456789" << ( OfflineEditLog::Operations() << Op::insert(5, "X") )
+                                       << "0129" << "012X9";
+    QTest::newRow("remove_both") << "0123456789" << ( OfflineEditLog::Operations() << Op::erase(2, 4) )
+                                 << "01234789" << "01789";
+    QTest::newRow("remove_around_insert") << "0123456789" << ( OfflineEditLog::Operations() << Op::erase(2, 6) )
+                                          << "01234X56789" << "01X89";
+    QTest::newRow("multiline") << "foo\nbar\n" << ( OfflineEditLog::Operations() << Op::insert(4, "baz\n") )
+                               << "foo\nqux\nbar\n" << "foo\nqux\nbaz\nbar\n";
+}
+
+void CollaborativeEditingTest::testAuthorshipMap()
+{
+    AuthorshipMap map;
+    map.reset(QVector<int>() << 5 << 0 << 3);
+    QCOMPARE(map.lineCount(), 3);
+    QCOMPARE(map.authorAt(Cursor(0, 2)), QString());
+    QCOMPARE(map.authorForLine(0), QString());
+
+    // typing in the middle of a line
+    map.insert(Cursor(0, 2), "ab", "alice");
+    map.insert(Cursor(0, 4), "c", "alice");
+    QCOMPARE(map.lineLength(0), 8);
+    QCOMPARE(map.runs(0).size(), 3);
+    QCOMPARE(map.authorAt(Cursor(0, 1)), QString());
+    QCOMPARE(map.authorAt(Cursor(0, 2)), QString("alice"));
+    QCOMPARE(map.authorAt(Cursor(0, 4)), QString("alice"));
+    QCOMPARE(map.authorAt(Cursor(0, 5)), QString());
+    QCOMPARE(map.authorForLine(0), QString("alice"));
+
+    // inserting lines splits the line, the text after the insertion moves along
+    map.insert(Cursor(0, 3), "x\ny\nz", "bob");
+    QCOMPARE(map.lineCount(), 5);
+    QCOMPARE(map.lineLength(0), 4);
+    QCOMPARE(map.authorAt(Cursor(0, 3)), QString("bob"));
+    QCOMPARE(map.authorForLine(1), QString("bob"));
+    QCOMPARE(map.lineLength(2), 6);
+    QCOMPARE(map.authorAt(Cursor(2, 0)), QString("bob"));
+    QCOMPARE(map.authorAt(Cursor(2, 1)), QString("alice"));
+    QCOMPARE(map.authorAt(Cursor(2, 3)), QString());
+    QCOMPARE(map.authorsInRange(Range(0, 0, 2, 6)), QStringList() << "alice" << "bob");
+    QCOMPARE(map.authorsInRange(Range(1, 0, 2, 1)), QStringList() << "bob");
+
+    // removing across lines joins them again
+    map.remove(Range(0, 3, 2, 1));
+    QCOMPARE(map.lineCount(), 3);
+    QCOMPARE(map.lineLength(0), 8);
+    QCOMPARE(map.runs(0).size(), 3);
+    QCOMPARE(map.authorsInRange(Range(0, 0, 0, 8)), QStringList() << "alice");
+
+    map.remove(Range(0, 2, 0, 5));
+    QCOMPARE(map.runs(0).size(), 1);
+    QCOMPARE(map.authorForLine(0), QString());
+    QCOMPARE(map.authorAt(Cursor(2, 3)), QString());
+}
+
+void CollaborativeEditingTest::testAuthorshipMapSaveRestore()
+{
+    AuthorshipMap map;
+    map.reset(QVector<int>() << 3);
+    map.insert(Cursor(0, 1), "ab\ncd\n\nef", "alice");
+    map.insert(Cursor(3, 1), "x", "bob");
+    const QVector<int> lineLengths = QVector<int>() << 3 << 2 << 0 << 5;
+    for ( int i = 0; i < lineLengths.size(); i++ ) {
+        QCOMPARE(map.lineLength(i), lineLengths.at(i));
+    }
+    const QByteArray data = map.save();
+
+    AuthorshipMap restored;
+    restored.insert(Cursor(0, 0), "bob", "bob");
+    QVERIFY(! restored.restore(data, QVector<int>() << 3 << 2 << 0 << 4));
+    QVERIFY(! restored.restore(QByteArray("garbage"), lineLengths));
+    QCOMPARE(restored.authorForLine(0), QString("bob"));
+    QVERIFY(restored.restore(data, lineLengths));
+    QCOMPARE(restored.lineCount(), map.lineCount());
+    for ( int line = 0; line < map.lineCount(); line++ ) {
+        QCOMPARE(restored.lineLength(line), map.lineLength(line));
+        QCOMPARE(restored.runs(line).size(), map.runs(line).size());
+        for ( int column = 0; column < map.lineLength(line); column++ ) {
+            QCOMPARE(restored.authorAt(Cursor(line, column)), map.authorAt(Cursor(line, column)));
+        }
+    }
+    QCOMPARE(restored.authorsInRange(Range(0, 0, 3, 5)), QStringList() << "alice" << "bob");
+}
 
 #include "collaborativeeditingtest.moc"
@@ -32,6 +32,8 @@
 #include <KTextEditor/Editor>
 
 #include "ktecollaborativeplugin.h"
+#include "offlineeditlog.h"
+#include "authorshipmap.h"
 
 #define NEED_SYNC_CYCLES 30
 
@@ -107,6 +109,7 @@ void replayTransaction(const QList<Operation*> transaction, KTextEditor::Documen
 }
 
 Q_DECLARE_METATYPE(QList<Operation*>);
+Q_DECLARE_METATYPE(OfflineEditLog::Operations);
 
 class CollaborativeEditingTest : public QObject
 {
@@ -132,6 +135,12 @@ private slots:
 
     void testSnippets();
 
+    void testOfflineEditLog();
+    void testOfflineEditLog_data();
+
+    void testAuthorshipMap();
+    void testAuthorshipMapSaveRestore();
+
 private:
     inline KteCollaborativePlugin* plugin_A() {
         return m_plugin_A;